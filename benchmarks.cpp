@@ -0,0 +1,555 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "socow-builder.h"
+#include "socow-flat.h"
+#include "socow-io.h"
+#include "socow-jagged.h"
+#include "socow-mmap.h"
+#include "socow-packed.h"
+#include "socow-parallel.h"
+#include "socow-pool.h"
+#include "socow-simd.h"
+#include "socow-soa.h"
+#include "socow-vector.h"
+
+namespace {
+size_t volatile sink;
+
+template <typename F>
+double measure(F&& f, size_t reps = 20) {
+    double best = 1e300;
+    for (size_t run = 0; run != 5; ++run) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i != reps; ++i) {
+            f();
+        }
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count() / reps);
+    }
+    return best;
+}
+
+void report(char const* name, double ns) {
+    std::printf("%-48s %14.1f ns\n", name, ns);
+}
+
+template <typename F>
+void report_latency(char const* name, F&& f, size_t samples = 200000) {
+    std::vector<double> ns(samples);
+    for (size_t i = 0; i != samples; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        f(i);
+        ns[i] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    }
+    std::sort(ns.begin(), ns.end());
+    std::printf("%-48s p50 %8.1f ns  p99 %8.1f ns  max %10.1f ns\n", name, ns[samples / 2],
+                ns[samples * 99 / 100], ns[samples - 1]);
+}
+
+template <typename T>
+socow_vector<T, 4> needle_at_end(size_t n) {
+    socow_vector<T, 4> result;
+    for (size_t i = 0; i != n; ++i) {
+        result.push_back(static_cast<T>(i + 1 == n));
+    }
+    return result;
+}
+
+template <typename T>
+void bench_search(char const* type) {
+    size_t const n = 1 << 20;
+    socow_vector<T, 4> const a = needle_at_end<T>(n);
+    socow_vector<T, 4> b = a;
+    b.reserve(n);
+    T const needle = a[n - 1];
+    char name[64];
+
+    std::snprintf(name, sizeof(name), "find<%s> std::find", type);
+    report(name, measure([&] { sink = std::find(a.begin(), a.end(), needle) - a.begin(); }));
+    std::snprintf(name, sizeof(name), "find<%s> socow_vector::find", type);
+    report(name, measure([&] { sink = a.find(needle) - a.begin(); }));
+    std::snprintf(name, sizeof(name), "count<%s> std::count", type);
+    report(name, measure([&] { sink = std::count(a.begin(), a.end(), needle); }));
+    std::snprintf(name, sizeof(name), "count<%s> socow_vector::count", type);
+    report(name, measure([&] { sink = a.count(needle); }));
+
+    socow_vector<T, 4> const& c = b;
+    std::snprintf(name, sizeof(name), "equal<%s> std::equal", type);
+    report(name, measure([&] { sink = std::equal(a.begin(), a.end(), c.begin(), c.end()); }));
+    std::snprintf(name, sizeof(name), "equal<%s> operator==", type);
+    report(name, measure([&] { sink = a == c; }));
+    socow_vector<T, 4> const shared = a;
+    std::snprintf(name, sizeof(name), "equal<%s> operator== shared", type);
+    report(name, measure([&] { sink = a == shared; }));
+}
+
+void bench_hash() {
+    size_t const n = 1 << 20;
+    socow_vector<uint32_t, 4> a = needle_at_end<uint32_t>(n);
+    socow_vector<uint32_t, 4> const& c = a;
+    std::hash<socow_vector<uint32_t, 4>> hasher;
+
+    report("hash<uint32_t> per-element combine", measure([&] {
+        size_t h = 0;
+        for (uint32_t x : c) {
+            h = h * 31 + std::hash<uint32_t>()(x);
+        }
+        sink = h;
+    }));
+    report("hash<uint32_t> first computation", measure([&] {
+        a[0] = 0;
+        sink = hasher(a);
+    }));
+    socow_vector<uint32_t, 4> const shared = a;
+    report("hash<uint32_t> cached, shared copy", measure([&] { sink = hasher(shared); }));
+}
+
+void bench_pool() {
+    std::vector<socow_vector<uint64_t, 4>> sources;
+    for (size_t n : {16, 40, 100, 250, 600}) {
+        sources.push_back(needle_at_end<uint64_t>(n));
+    }
+    auto detach = [&](size_t i) {
+        socow_vector<uint64_t, 4> copy = sources[i % sources.size()];
+        copy[0] = i;
+        sink = copy.size();
+    };
+    report_latency("detach+free, operator new", detach);
+    socow_block_pool::set_enabled(true);
+    report_latency("detach+free, socow_block_pool", detach);
+    socow_block_pool::trim();
+    socow_block_pool::set_enabled(false);
+}
+
+void bench_parallel_copy() {
+    size_t const n = size_t(1) << 25;
+    socow_vector<uint32_t, 4> const a = needle_at_end<uint32_t>(n);
+    auto detach = [&] {
+        socow_vector<uint32_t, 4> copy = a;
+        copy[0] = 1;
+        sink = copy.size();
+    };
+    report("detach 128 MiB serial", measure(detach, 3));
+    socow_parallel::set_threshold(size_t(16) << 20);
+    report("detach 128 MiB socow_parallel", measure(detach, 3));
+    socow_parallel::set_threshold(0);
+}
+
+void bench_streaming_copy() {
+    size_t const n = size_t(256) << 20;
+    std::vector<char> src(n, 1), dst(n);
+    double ns = measure([&] { std::memcpy(dst.data(), src.data(), n); }, 3);
+    std::printf("%-48s %14.2f GB/s\n", "copy 256 MiB memcpy", n / ns);
+    ns = measure([&] { socow_simd::stream_bytes(dst.data(), src.data(), n); }, 3);
+    std::printf("%-48s %14.2f GB/s\n", "copy 256 MiB stream_bytes", n / ns);
+
+    std::vector<uint64_t> working_set((size_t(2) << 20) / sizeof(uint64_t), 1);
+    auto reader_pass_ns = [&](auto copy) {
+        std::atomic<bool> stop(false);
+        std::thread copier([&] {
+            while (!stop.load(std::memory_order_relaxed)) {
+                copy();
+            }
+        });
+        double best = measure([&] {
+            uint64_t sum = 0;
+            for (uint64_t x : working_set) {
+                sum += x;
+            }
+            sink = sum;
+        }, 200);
+        stop = true;
+        copier.join();
+        return best;
+    };
+    report("2 MiB reader pass, concurrent memcpy", reader_pass_ns([&] { std::memcpy(dst.data(), src.data(), n); }));
+    report("2 MiB reader pass, concurrent stream_bytes",
+           reader_pass_ns([&] { socow_simd::stream_bytes(dst.data(), src.data(), n); }));
+}
+
+void bench_migration() {
+    using vector = socow_vector<uint32_t, 4>;
+    size_t const n = size_t(1) << 22;
+    for (size_t step : {size_t(0), size_t(64)}) {
+        vector::set_migration_step(step);
+        char name[64];
+        vector grown;
+        std::snprintf(name, sizeof(name), "push_back x 4M, migration step %zu", step);
+        report_latency(name, [&](size_t i) { grown.push_back(static_cast<uint32_t>(i)); }, n);
+
+        vector copy;
+        std::snprintf(name, sizeof(name), "write after copy of 4M, migration step %zu", step);
+        report_latency(name, [&](size_t i) {
+            if (i % 1024 == 0) {
+                copy = grown;
+            }
+            copy[i % n] = 1;
+        }, 64 * 1024);
+    }
+    vector::set_migration_step(0);
+}
+
+void bench_builder() {
+    size_t const per_thread = size_t(1) << 20;
+    for (size_t threads : {1, 2, 4}) {
+        char name[64];
+        std::snprintf(name, sizeof(name), "ingest %zu x 1M, mutex + push_back", threads);
+        report(name, measure([&] {
+            socow_vector<uint64_t, 4> v;
+            std::mutex m;
+            std::vector<std::thread> producers;
+            for (size_t t = 0; t != threads; ++t) {
+                producers.emplace_back([&] {
+                    for (size_t i = 0; i != per_thread; ++i) {
+                        std::lock_guard<std::mutex> lock(m);
+                        v.push_back(i);
+                    }
+                });
+            }
+            for (auto& p : producers) {
+                p.join();
+            }
+            sink = v.size();
+        }, 3));
+        std::snprintf(name, sizeof(name), "ingest %zu x 1M, socow_concurrent_builder", threads);
+        report(name, measure([&] {
+            socow_concurrent_builder<uint64_t> builder(threads * per_thread);
+            std::vector<std::thread> producers;
+            for (size_t t = 0; t != threads; ++t) {
+                producers.emplace_back([&] {
+                    for (size_t i = 0; i != per_thread; ++i) {
+                        builder.push_back(i);
+                    }
+                });
+            }
+            for (auto& p : producers) {
+                p.join();
+            }
+            sink = builder.seal<4>().size();
+        }, 3));
+    }
+}
+
+void bench_soa() {
+    struct row {
+        uint64_t id;
+        double price;
+        uint32_t quantity;
+        char tag[20];
+    };
+    size_t const n = size_t(1) << 20;
+    socow_vector<row, 4> rows;
+    socow_soa_vector<4, uint64_t, double, uint32_t, std::array<char, 20>> columns;
+    for (size_t i = 0; i != n; ++i) {
+        rows.push_back(row{i, i * 0.25, static_cast<uint32_t>(i), {}});
+        columns.push_back(i, i * 0.25, static_cast<uint32_t>(i), {});
+    }
+    socow_vector<row, 4> const& crows = rows;
+    auto const& ccolumns = columns;
+
+    report("scan price, socow_vector<row>", measure([&] {
+        double sum = 0;
+        for (row const& r : crows) {
+            sum += r.price;
+        }
+        sink = static_cast<size_t>(sum);
+    }));
+    report("scan price, socow_soa_vector column", measure([&] {
+        double sum = 0;
+        for (double p : ccolumns.column<1>()) {
+            sum += p;
+        }
+        sink = static_cast<size_t>(sum);
+    }));
+    report("copy + write one price, socow_vector<row>", measure([&] {
+        socow_vector<row, 4> copy = rows;
+        copy[0].price = 1;
+        sink = copy.size();
+    }, 5));
+    report("copy + write one price, socow_soa_vector", measure([&] {
+        auto copy = columns;
+        copy.get<1>(0) = 1;
+        sink = copy.size();
+    }, 5));
+}
+
+void bench_flat_map() {
+    size_t const n = 4096;
+    std::map<uint64_t, uint64_t> tree;
+    socow_flat_map<uint64_t, uint64_t, 4> flat;
+    std::vector<std::pair<uint64_t, uint64_t>> pairs;
+    for (size_t i = 0; i != n; ++i) {
+        uint64_t key = i * 2654435761u % (n * 8);
+        tree.emplace(key, i);
+        pairs.emplace_back(key, i);
+    }
+    flat.insert(pairs.begin(), pairs.end());
+    auto const& cflat = flat;
+
+    report("snapshot, std::map", measure([&] {
+        std::map<uint64_t, uint64_t> copy = tree;
+        sink = copy.size();
+    }));
+    report("snapshot, socow_flat_map", measure([&] {
+        socow_flat_map<uint64_t, uint64_t, 4> copy = flat;
+        sink = copy.size();
+    }));
+    report("4096 lookups, std::map", measure([&] {
+        size_t hits = 0;
+        for (size_t i = 0; i != n; ++i) {
+            hits += tree.count(i * 7);
+        }
+        sink = hits;
+    }));
+    report("4096 lookups, socow_flat_map", measure([&] {
+        size_t hits = 0;
+        for (size_t i = 0; i != n; ++i) {
+            hits += cflat.contains(i * 7);
+        }
+        sink = hits;
+    }));
+}
+
+void bench_compress() {
+    size_t const n = size_t(1) << 22;
+    socow_vector<uint32_t, 4> ids;
+    uint32_t id = 0;
+    for (size_t i = 0; i != n; ++i) {
+        id += 1 + (static_cast<uint32_t>(i * 2654435761u) >> 28);
+        ids.push_back(id);
+    }
+    socow_vector<uint32_t, 4> const& cids = ids;
+    socow_vector<uint32_t, 4> packed = ids;
+    packed.compress();
+    size_t words = socow_packed::encoded_words(cids.begin(), n);
+    std::printf("%-48s %14.2f x\n", "compression ratio, 4M sorted uint32_t ids",
+                double(sizeof(uint32_t) * n) / double(sizeof(uint64_t) * words));
+
+    double plain = measure([&] {
+        uint64_t sum = 0;
+        for (uint32_t x : cids) {
+            sum += x;
+        }
+        sink = sum;
+    }, 5);
+    double streamed = measure([&] {
+        uint64_t sum = 0;
+        packed.for_each([&](uint32_t x) { sum += x; });
+        sink = sum;
+    }, 5);
+    report("sum 4M uint32_t, plain", plain);
+    report("sum 4M uint32_t, packed for_each", streamed);
+    std::printf("%-48s %14.2f GB/s\n", "decode throughput", double(sizeof(uint32_t) * n) / streamed);
+    report("contains (miss), packed", measure([&] {
+        sink = packed.contains(id + 1);
+    }, 5));
+    report("unpack on first read", measure([&] {
+        socow_vector<uint32_t, 4> copy = packed;
+        sink = static_cast<socow_vector<uint32_t, 4> const&>(copy).data()[0];
+    }, 5));
+}
+
+// Per copy, sharing costs a refcount update plus a detach when the copy is
+// written, and copying eagerly costs an allocation and a memcpy either way.
+// Eager copies win once writes follow more than the printed share of copies.
+void bench_eager_copy() {
+    using vector = socow_vector<uint64_t, 4>;
+    size_t const reps = 4096;
+    for (size_t bytes : {64, 128, 256, 512, 1024, 4096, 16384}) {
+        vector const source = needle_at_end<uint64_t>(bytes / sizeof(uint64_t));
+        double cost[2][2];
+        for (int eager = 0; eager != 2; ++eager) {
+            vector::set_eager_copy(eager ? bytes : 0);
+            for (int write = 0; write != 2; ++write) {
+                cost[eager][write] = measure([&] {
+                    for (size_t i = 0; i != reps; ++i) {
+                        vector copy = source;
+                        if (write) {
+                            copy[0] = i;
+                        }
+                        sink = copy.size();
+                    }
+                }) / reps;
+            }
+        }
+        vector::set_eager_copy(0);
+        char name[64];
+        std::snprintf(name, sizeof(name), "copy %zu B, shared, read / written", bytes);
+        std::printf("%-48s %8.1f / %8.1f ns\n", name, cost[0][0], cost[0][1]);
+        std::snprintf(name, sizeof(name), "copy %zu B, eager, read / written", bytes);
+        std::printf("%-48s %8.1f / %8.1f ns\n", name, cost[1][0], cost[1][1]);
+        double gain = (cost[0][1] - cost[1][1]) - (cost[0][0] - cost[1][0]);
+        double crossover = gain > 0 ? (cost[1][0] - cost[0][0]) / gain : 1;
+        std::printf("%-48s %8.0f %%\n", "  eager wins above written share", 100 * std::min(std::max(crossover, 0.0), 1.0));
+    }
+}
+
+void bench_resize() {
+    size_t const n = size_t(32) << 20;
+    report("size 32M histogram, push_back zeros", measure([&] {
+        socow_vector<uint32_t, 4> hist;
+        for (size_t i = 0; i != n; ++i) {
+            hist.push_back(0);
+        }
+        sink = hist.size();
+    }, 3));
+    report("size 32M histogram, resize + 1/16 pages touched", measure([&] {
+        socow_vector<uint32_t, 4> hist;
+        hist.resize(n);
+        for (size_t i = 0; i < n; i += 16384) {
+            hist[i]++;
+        }
+        sink = hist.size();
+    }, 3));
+}
+
+// Rows of 0 to 16 values, as a vector of vectors and as socow_jagged.
+void bench_jagged() {
+    using row = socow_vector<size_t, 2>;
+    using nested = socow_vector<row, 2>;
+    size_t const rows = 10000;
+    size_t const header = sizeof(socow_detail::block_header);
+    auto length = [](size_t i) { return i * 7 % 17; };
+    nested n;
+    report("build 10k rows, nested", measure([&] {
+        n = nested();
+        for (size_t i = 0; i != rows; ++i) {
+            n.push_back(row());
+            for (size_t j = 0; j != length(i); ++j) {
+                n.back().push_back(j);
+            }
+        }
+    }, 3));
+    socow_jagged<size_t, 4> jagged;
+    report("build 10k rows, socow_jagged", measure([&] {
+        jagged = socow_jagged<size_t, 4>();
+        for (size_t i = 0; i != rows; ++i) {
+            jagged.push_row();
+            for (size_t j = 0; j != length(i); ++j) {
+                jagged.push_back(j);
+            }
+        }
+    }, 3));
+
+    nested const& cn = n;
+    report("sum 10k rows, nested", measure([&] {
+        size_t sum = 0;
+        for (row const& r : cn) {
+            for (size_t x : r) {
+                sum += x;
+            }
+        }
+        sink = sum;
+    }));
+    socow_jagged<size_t, 4> const& cj = jagged;
+    report("sum 10k rows, socow_jagged", measure([&] {
+        size_t sum = 0;
+        for (auto r : cj) {
+            for (size_t x : r) {
+                sum += x;
+            }
+        }
+        sink = sum;
+    }));
+    report("copy + write one value, nested", measure([&] {
+        nested copy = n;
+        copy[rows / 2][0] = 1;
+        sink = copy.size();
+    }));
+    report("copy + write one value, socow_jagged", measure([&] {
+        socow_jagged<size_t, 4> copy = jagged;
+        copy[rows / 2][0] = 1;
+        sink = copy.size();
+    }));
+
+    size_t nested_bytes = header + cn.capacity() * sizeof(row);
+    for (row const& r : cn) {
+        nested_bytes += r.capacity() > 2 ? header + r.capacity() * sizeof(size_t) : 0;
+    }
+    size_t jagged_bytes = 2 * header + (cj.values().capacity() + cj.offsets().capacity()) * sizeof(size_t);
+    std::printf("%-48s %14zu B\n", "memory, nested", nested_bytes);
+    std::printf("%-48s %14zu B\n", "memory, socow_jagged", jagged_bytes);
+}
+
+void bench_io() {
+    size_t const n = 1 << 20;
+    socow_vector<uint32_t, 4> const a = needle_at_end<uint32_t>(n);
+    char name[] = "/tmp/socow-bench-XXXXXX";
+    int fd = mkstemp(name);
+
+    report("io 1M uint32_t per-element ofstream write", measure([&] {
+        std::ofstream out(name, std::ios::binary | std::ios::trunc);
+        for (uint32_t x : a) {
+            out.write(reinterpret_cast<char const*>(&x), sizeof(x));
+        }
+    }, 5));
+    report("io 1M uint32_t per-element ifstream read", measure([&] {
+        std::ifstream in(name, std::ios::binary);
+        socow_vector<uint32_t, 4> b;
+        uint32_t x;
+        while (in.read(reinterpret_cast<char*>(&x), sizeof(x))) {
+            b.push_back(x);
+        }
+        sink = b.size();
+    }, 5));
+    report("io 1M uint32_t socow_io::write", measure([&] {
+        ftruncate(fd, 0);
+        lseek(fd, 0, SEEK_SET);
+        socow_io::write(fd, a);
+    }, 5));
+    report("io 1M uint32_t socow_io::read", measure([&] {
+        lseek(fd, 0, SEEK_SET);
+        sink = socow_io::read<socow_vector<uint32_t, 4>>(fd).size();
+    }, 5));
+    report("io 1M uint32_t socow_mapped_file::open", measure([&] {
+        sink = socow_mapped_file::open<uint32_t, 4>(name).size();
+    }, 5));
+
+    std::vector<socow_vector<uint32_t, 4>> batch(4096, needle_at_end<uint32_t>(64));
+    report("io 4096 x 64 uint32_t write loop", measure([&] {
+        ftruncate(fd, 0);
+        lseek(fd, 0, SEEK_SET);
+        for (auto const& v : batch) {
+            socow_io::write(fd, v);
+        }
+    }, 5));
+    report("io 4096 x 64 uint32_t write_batch", measure([&] {
+        ftruncate(fd, 0);
+        lseek(fd, 0, SEEK_SET);
+        socow_io::write_batch(fd, batch.begin(), batch.end());
+    }, 5));
+
+    close(fd);
+    unlink(name);
+}
+} // namespace
+
+int main() {
+    bench_search<uint8_t>("uint8_t");
+    bench_search<uint32_t>("uint32_t");
+    bench_search<uint64_t>("uint64_t");
+    bench_search<double>("double");
+    bench_hash();
+    bench_pool();
+    bench_parallel_copy();
+    bench_streaming_copy();
+    bench_migration();
+    bench_builder();
+    bench_soa();
+    bench_flat_map();
+    bench_compress();
+    bench_eager_copy();
+    bench_resize();
+    bench_jagged();
+    bench_io();
+}
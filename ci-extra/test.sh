@@ -3,3 +3,5 @@ set -euo pipefail
 IFS=$' \t\n'
 
 cmake-build-$1/tests
+cmake-build-$1/tests_cxx20
+cmake-build-$1/profile_tests
@@ -0,0 +1,68 @@
+#include <algorithm>
+#include <sstream>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "socow-profile.h"
+#include "socow-vector.h"
+
+// Built separately with SOCOW_PROFILE, which changes the layout of every
+// socow_vector and so cannot be mixed with the other tests.
+
+TEST(profile, sampled_sizes_and_promotions) {
+    socow_profile::reset();
+    socow_profile::set_sample_period(1);
+    socow_profile::set_enabled(true);
+    {
+        socow_profile::scope tag("profile_test");
+        for (size_t n = 0; n != 10; ++n) {
+            socow_vector<short, 3> v;
+            for (short i = 0; i != static_cast<short>(n); ++i)
+                v.push_back(i);
+            if (n == 9) {
+                while (v.size() > 2)
+                    v.pop_back();
+                v.shrink_to_fit();
+            }
+        }
+    }
+    socow_profile::set_enabled(false);
+    socow_profile::set_sample_period(64);
+
+    auto all = socow_profile::snapshot();
+    auto it = std::find_if(all.begin(), all.end(), [](socow_profile::stats const& s) { return s.site == "profile_test"; });
+    ASSERT_NE(all.end(), it);
+    EXPECT_EQ(3, it->small_size);
+    EXPECT_EQ(sizeof(short), it->element_size);
+    EXPECT_EQ(10, it->objects);
+    EXPECT_EQ(6, it->promotions);
+    EXPECT_EQ(1, it->demotions);
+    EXPECT_EQ(1, it->peak_sizes.at(9));
+    EXPECT_EQ(2, it->final_sizes.at(2));
+    EXPECT_EQ(0, it->final_sizes.count(9));
+    EXPECT_EQ(9, socow_profile::percentile(it->peak_sizes, 100));
+
+    socow_profile::recommendation fewest = socow_profile::recommend(*it, socow_profile::goal::allocations, 16);
+    EXPECT_EQ(9, fewest.small_size);
+    EXPECT_EQ(0, fewest.allocations);
+    socow_profile::recommendation current = socow_profile::evaluate(*it, 3);
+    EXPECT_EQ(6 + 3, current.allocations);
+    std::ostringstream report;
+    socow_profile::report(report);
+    EXPECT_NE(std::string::npos, report.str().find("[profile_test]"));
+}
+
+TEST(profile, recommends_size_covering_common_case) {
+    socow_profile::stats st;
+    st.element_size = 8;
+    st.small_size = 1;
+    st.block_overhead = 48;
+    st.peak_sizes[4] = 1000;
+    st.peak_sizes[500] = 1;
+    socow_profile::recommendation memory = socow_profile::recommend(st, socow_profile::goal::memory);
+    EXPECT_EQ(4, memory.small_size);
+    EXPECT_EQ(7, memory.allocations);
+    EXPECT_LT(memory.bytes, socow_profile::evaluate(st, 1).bytes);
+    EXPECT_EQ(250, socow_profile::recommend(st, socow_profile::goal::allocations).small_size);
+}
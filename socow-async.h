@@ -0,0 +1,108 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+#include "socow-parallel.h"
+#include "socow-vector.h"
+
+// Copies shared heap blocks ahead of the write that would detach them, for
+// socow_vector::detach_async and prepare_write. Pending copies live in one
+// table keyed by the address of the vector, which therefore must not be
+// relocated behind its back while a copy is pending.
+struct socow_async {
+    template <typename T, size_t SMALL_SIZE, typename Executor>
+    static std::shared_future<void> detach(socow_vector<T, SMALL_SIZE>& v, Executor&& executor) {
+        if (v.pending_) {
+            std::lock_guard<std::mutex> lock(mutex());
+            return table().at(&v)->ready;
+        }
+        if constexpr (std::is_trivially_copyable<T>::value) {
+            if (!v.small && !v.compressed_ && !v.dynamic_storage.unique()) {
+                return start(v, std::forward<Executor>(executor));
+            }
+        }
+        std::promise<void> done;
+        done.set_value();
+        return done.get_future().share();
+    }
+
+    template <typename T, size_t SMALL_SIZE>
+    static std::shared_future<void> prepare_write(socow_vector<T, SMALL_SIZE>& v) {
+        return detach(v, [](std::function<void()> task) { socow_parallel::submit(std::move(task)); });
+    }
+
+private:
+    struct entry {
+        socow_detail::block_header* source;
+        std::shared_future<void> ready;
+        socow_detail::block_header* copy;
+    };
+
+    static std::mutex& mutex() {
+        static std::mutex m;
+        return m;
+    }
+
+    static std::unordered_map<void const*, std::unique_ptr<entry>>& table() {
+        static std::unordered_map<void const*, std::unique_ptr<entry>> t;
+        return t;
+    }
+
+    template <typename T, size_t SMALL_SIZE, typename Executor>
+    static std::shared_future<void> start(socow_vector<T, SMALL_SIZE>& v, Executor&& executor) {
+        using content = socow_detail::content<T>;
+        using storage = socow_detail::storage<T>;
+        socow_detail::take_pending.store(&take, std::memory_order_release);
+        content* source = v.dynamic_storage.content_ptr;
+        size_t size = v.size_;
+        std::unique_ptr<entry> p(new entry{source, {}, nullptr});
+        auto done = std::make_shared<std::promise<void>>();
+        p->ready = done->get_future().share();
+        entry* raw = p.get();
+        std::shared_future<void> ready = p->ready;
+        {
+            std::lock_guard<std::mutex> lock(mutex());
+            table().emplace(&v, std::move(p));
+        }
+        socow_detail::retain(source);
+        v.pending_ = true;
+        try {
+            executor(std::function<void()>([raw, source, size, done] {
+                content* c = nullptr;
+                try {
+                    c = storage::allocate(source->capacity_);
+                    socow_vector<T, SMALL_SIZE>::copy(source->data(), source->data() + size, c->data());
+                    raw->copy = c;
+                } catch (...) {
+                    if (c != nullptr) {
+                        storage discard(c);
+                    }
+                }
+                done->set_value();
+            }));
+        } catch (...) {
+            done->set_value();
+            v.settle();
+            throw;
+        }
+        return ready;
+    }
+
+    static socow_detail::pending_copy take(void const* v) noexcept {
+        std::unique_ptr<entry> p;
+        {
+            std::lock_guard<std::mutex> lock(mutex());
+            auto it = table().find(v);
+            p = std::move(it->second);
+            table().erase(it);
+        }
+        p->ready.wait();
+        return {p->source, p->copy};
+    }
+};
@@ -0,0 +1,527 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+
+#include "socow-vector.h"
+
+// Flags packed 64 to a word. The words live in a socow_vector of their own,
+// so the inline buffer holds SMALL_SIZE bits and copies share the heap block
+// exactly like any other socow_vector. Bits past size() are kept zero. Like
+// std::vector<bool>, elements are reached through proxy references and
+// iterators, and there is no data(); words() exposes the packed form.
+template <size_t SMALL_SIZE>
+struct socow_vector<bool, SMALL_SIZE> {
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    class reference {
+    public:
+        operator bool() const noexcept {
+            return (*word_ & mask_) != 0;
+        }
+
+        reference& operator=(bool value) noexcept {
+            *word_ = value ? *word_ | mask_ : *word_ & ~mask_;
+            return *this;
+        }
+
+        reference& operator=(reference const& that) noexcept {
+            return *this = static_cast<bool>(that);
+        }
+
+        void flip() noexcept {
+            *word_ ^= mask_;
+        }
+
+    private:
+        friend struct socow_vector;
+
+        reference(uint64_t* word, uint64_t mask) noexcept
+            : word_(word), mask_(mask) {}
+
+        uint64_t* word_;
+        uint64_t mask_;
+    };
+
+    // Random access over the flags; Word is uint64_t for iterator and
+    // uint64_t const for const_iterator.
+    template <typename Word>
+    class basic_iterator {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = bool;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = std::conditional_t<std::is_const<Word>::value, bool, typename socow_vector::reference>;
+
+        basic_iterator() noexcept = default;
+
+        template <typename W, typename = std::enable_if_t<std::is_same<W const, Word>::value>>
+        basic_iterator(basic_iterator<W> const& that) noexcept
+            : words_(that.words_), i_(that.i_) {}
+
+        reference operator*() const noexcept {
+            return socow_vector::at_bit(words_, i_);
+        }
+
+        reference operator[](difference_type n) const noexcept {
+            return socow_vector::at_bit(words_, i_ + n);
+        }
+
+        basic_iterator& operator++() noexcept {
+            ++i_;
+            return *this;
+        }
+
+        basic_iterator operator++(int) noexcept {
+            basic_iterator result = *this;
+            ++i_;
+            return result;
+        }
+
+        basic_iterator& operator--() noexcept {
+            --i_;
+            return *this;
+        }
+
+        basic_iterator operator--(int) noexcept {
+            basic_iterator result = *this;
+            --i_;
+            return result;
+        }
+
+        basic_iterator& operator+=(difference_type n) noexcept {
+            i_ += n;
+            return *this;
+        }
+
+        basic_iterator& operator-=(difference_type n) noexcept {
+            i_ -= n;
+            return *this;
+        }
+
+        friend basic_iterator operator+(basic_iterator it, difference_type n) noexcept {
+            return it += n;
+        }
+
+        friend basic_iterator operator+(difference_type n, basic_iterator it) noexcept {
+            return it += n;
+        }
+
+        friend basic_iterator operator-(basic_iterator it, difference_type n) noexcept {
+            return it -= n;
+        }
+
+        friend difference_type operator-(basic_iterator const& a, basic_iterator const& b) noexcept {
+            return static_cast<difference_type>(a.i_ - b.i_);
+        }
+
+        friend bool operator==(basic_iterator const& a, basic_iterator const& b) noexcept {
+            return a.i_ == b.i_;
+        }
+
+        friend bool operator!=(basic_iterator const& a, basic_iterator const& b) noexcept {
+            return a.i_ != b.i_;
+        }
+
+        friend bool operator<(basic_iterator const& a, basic_iterator const& b) noexcept {
+            return a.i_ < b.i_;
+        }
+
+        friend bool operator>(basic_iterator const& a, basic_iterator const& b) noexcept {
+            return b.i_ < a.i_;
+        }
+
+        friend bool operator<=(basic_iterator const& a, basic_iterator const& b) noexcept {
+            return a.i_ <= b.i_;
+        }
+
+        friend bool operator>=(basic_iterator const& a, basic_iterator const& b) noexcept {
+            return a.i_ >= b.i_;
+        }
+
+    private:
+        friend struct socow_vector;
+        template <typename>
+        friend class basic_iterator;
+
+        basic_iterator(Word* words, size_t i) noexcept
+            : words_(words), i_(i) {}
+
+        Word* words_ = nullptr;
+        size_t i_ = 0;
+    };
+
+    using iterator = basic_iterator<uint64_t>;
+    using const_iterator = basic_iterator<uint64_t const>;
+
+    socow_vector() noexcept
+        : size_(0) {}
+
+    reference operator[](size_t i) {
+        return reference(&words_[i / bits], bit(i));
+    }
+
+    bool operator[](size_t i) const noexcept {
+        return (word(i / bits) & bit(i)) != 0;
+    }
+
+    reference front() {
+        return (*this)[0];
+    }
+
+    bool front() const noexcept {
+        return (*this)[0];
+    }
+
+    reference back() {
+        return (*this)[size_ - 1];
+    }
+
+    bool back() const noexcept {
+        return (*this)[size_ - 1];
+    }
+
+    // Detaches a shared block.
+    iterator begin() {
+        return iterator(words_.data(), 0);
+    }
+
+    iterator end() {
+        return begin() + size_;
+    }
+
+    const_iterator begin() const noexcept {
+        return const_iterator(words(), 0);
+    }
+
+    const_iterator end() const noexcept {
+        return begin() + size_;
+    }
+
+    // Bit i % 64 of word i / 64 is flag i.
+    uint64_t const* words() const noexcept {
+        return words_.data();
+    }
+
+    size_t size() const noexcept {
+        return size_;
+    }
+
+    bool empty() const noexcept {
+        return size_ == 0;
+    }
+
+    size_t capacity() const noexcept {
+        return words_.capacity() * bits;
+    }
+
+    void push_back(bool value) {
+        if (size_ % bits == 0) {
+            words_.push_back(value ? 1 : 0);
+        } else if (value) {
+            words_[size_ / bits] |= bit(size_);
+        }
+        ++size_;
+    }
+
+    void pop_back() {
+        --size_;
+        if (size_ % bits == 0) {
+            words_.pop_back();
+        } else if ((*this)[size_]) {
+            words_[size_ / bits] &= ~bit(size_);
+        }
+    }
+
+    void resize(size_t n) {
+        resize(n, false);
+    }
+
+    void resize(size_t n, bool value) {
+        if (n <= size_) {
+            words_.resize(word_count(n));
+            if (n % bits != 0) {
+                words_[n / bits] &= bit(n) - 1;
+            }
+        } else {
+            words_.resize(word_count(n));
+            if (value) {
+                set_range(size_, n);
+            }
+        }
+        size_ = n;
+    }
+
+    iterator insert(const_iterator pos, bool value) {
+        size_t index = pos.i_;
+        push_back(false);
+        uint64_t* w = words_.data();
+        size_t first = index / bits;
+        for (size_t k = words_.size() - 1; k > first; --k) {
+            w[k] = w[k] << 1 | w[k - 1] >> (bits - 1);
+        }
+        uint64_t low = bit(index) - 1;
+        w[first] = (w[first] & low) | (w[first] & ~low) << 1;
+        if (value) {
+            w[first] |= bit(index);
+        }
+        return iterator(w, index);
+    }
+
+    iterator erase(const_iterator pos) {
+        return erase(pos, pos + 1);
+    }
+
+    // Moves the tail down a word at a time once the destination is aligned.
+    iterator erase(const_iterator first, const_iterator last) {
+        size_t start = first.i_;
+        size_t gap = last.i_ - first.i_;
+        uint64_t* w = words_.data();
+        size_t i = start;
+        for (; i % bits != 0 && i + gap < size_; ++i) {
+            at_bit(w, i) = static_cast<bool>(at_bit(w, i + gap));
+        }
+        for (; i + gap < size_; i += bits) {
+            w[i / bits] = bits_at(w, i + gap);
+        }
+        resize(size_ - gap);
+        return iterator(words_.data(), start);
+    }
+
+    void reserve(size_t new_cap) {
+        words_.reserve(word_count(new_cap));
+    }
+
+    void shrink_to_fit() {
+        words_.shrink_to_fit();
+    }
+
+    void clear() noexcept {
+        words_.clear();
+        size_ = 0;
+    }
+
+    void swap(socow_vector& that) {
+        words_.swap(that.words_);
+        std::swap(size_, that.size_);
+    }
+
+    // Inverts every flag.
+    void flip() {
+        if (size_ == 0) {
+            return;
+        }
+        uint64_t* w = words_.data();
+        size_t n = words_.size();
+        for (size_t i = 0; i != n; ++i) {
+            w[i] = ~w[i];
+        }
+        if (size_ % bits != 0) {
+            w[n - 1] &= bit(size_) - 1;
+        }
+    }
+
+    size_t count() const noexcept {
+        uint64_t const* w = words();
+        size_t result = 0;
+        for (size_t i = 0, n = words_.size(); i != n; ++i) {
+            result += popcount(w[i]);
+        }
+        return result;
+    }
+
+    bool any() const noexcept {
+        return find_first() != npos;
+    }
+
+    // Index of the first set flag, or npos.
+    size_t find_first() const noexcept {
+        return find_from(0, ~uint64_t(0));
+    }
+
+    // Index of the first set flag after pos, or npos.
+    size_t find_next(size_t pos) const noexcept {
+        size_t start = pos + 1;
+        if (start >= size_) {
+            return npos;
+        }
+        return find_from(start / bits, ~uint64_t(0) << (start % bits));
+    }
+
+    // The operands must have the same size.
+    socow_vector& operator&=(socow_vector const& that) {
+        return combine(that, [](uint64_t a, uint64_t b) { return a & b; });
+    }
+
+    socow_vector& operator|=(socow_vector const& that) {
+        return combine(that, [](uint64_t a, uint64_t b) { return a | b; });
+    }
+
+    socow_vector& operator^=(socow_vector const& that) {
+        return combine(that, [](uint64_t a, uint64_t b) { return a ^ b; });
+    }
+
+    friend socow_vector operator&(socow_vector a, socow_vector const& b) {
+        return a &= b;
+    }
+
+    friend socow_vector operator|(socow_vector a, socow_vector const& b) {
+        return a |= b;
+    }
+
+    friend socow_vector operator^(socow_vector a, socow_vector const& b) {
+        return a ^= b;
+    }
+
+    friend bool operator==(socow_vector const& a, socow_vector const& b) {
+        return a.size_ == b.size_ && a.words_ == b.words_;
+    }
+
+    friend bool operator!=(socow_vector const& a, socow_vector const& b) {
+        return !(a == b);
+    }
+
+    // false orders before true. The first differing word decides by its
+    // lowest differing bit; bits past size() are zero on both sides.
+    friend bool operator<(socow_vector const& a, socow_vector const& b) noexcept {
+        size_t n = a.size_ < b.size_ ? a.size_ : b.size_;
+        uint64_t const* x = a.words();
+        uint64_t const* y = b.words();
+        for (size_t k = 0; k != word_count(n); ++k) {
+            uint64_t diff = x[k] ^ y[k];
+            if (k == n / bits) {
+                diff &= bit(n) - 1;
+            }
+            if (diff != 0) {
+                return (y[k] >> lowest_bit(diff) & 1) != 0;
+            }
+        }
+        return a.size_ < b.size_;
+    }
+
+    friend bool operator>(socow_vector const& a, socow_vector const& b) noexcept {
+        return b < a;
+    }
+
+    friend bool operator<=(socow_vector const& a, socow_vector const& b) noexcept {
+        return !(b < a);
+    }
+
+    friend bool operator>=(socow_vector const& a, socow_vector const& b) noexcept {
+        return !(a < b);
+    }
+
+private:
+    using words_type = socow_vector<uint64_t, (SMALL_SIZE + 63) / 64>;
+
+    friend struct std::hash<socow_vector>;
+
+    static constexpr size_t bits = 64;
+
+    static constexpr uint64_t bit(size_t i) noexcept {
+        return uint64_t(1) << (i % bits);
+    }
+
+    static constexpr size_t word_count(size_t n) noexcept {
+        return (n + bits - 1) / bits;
+    }
+
+    static size_t popcount(uint64_t w) noexcept {
+#if defined(__GNUC__)
+        return static_cast<size_t>(__builtin_popcountll(w));
+#else
+        size_t result = 0;
+        for (; w != 0; w &= w - 1) {
+            ++result;
+        }
+        return result;
+#endif
+    }
+
+    static size_t lowest_bit(uint64_t w) noexcept {
+#if defined(__GNUC__)
+        return static_cast<size_t>(__builtin_ctzll(w));
+#else
+        size_t result = 0;
+        for (; (w & 1) == 0; w >>= 1) {
+            ++result;
+        }
+        return result;
+#endif
+    }
+
+    static reference at_bit(uint64_t* words, size_t i) noexcept {
+        return reference(words + i / bits, bit(i));
+    }
+
+    static bool at_bit(uint64_t const* words, size_t i) noexcept {
+        return (words[i / bits] & bit(i)) != 0;
+    }
+
+    // The 64 flags starting at i; those past the last word read as zero.
+    uint64_t bits_at(uint64_t const* w, size_t i) const noexcept {
+        size_t k = i / bits;
+        size_t n = words_.size();
+        uint64_t result = k < n ? w[k] >> (i % bits) : 0;
+        if (i % bits != 0 && k + 1 < n) {
+            result |= w[k + 1] << (bits - i % bits);
+        }
+        return result;
+    }
+
+    void set_range(size_t from, size_t to) {
+        uint64_t* w = words_.data();
+        for (; from != to && from % bits != 0; ++from) {
+            w[from / bits] |= bit(from);
+        }
+        for (; to - from >= bits; from += bits) {
+            w[from / bits] = ~uint64_t(0);
+        }
+        if (from != to) {
+            w[from / bits] |= bit(to) - 1;
+        }
+    }
+
+    uint64_t word(size_t i) const noexcept {
+        words_type const& w = words_;
+        return w[i];
+    }
+
+    size_t find_from(size_t first_word, uint64_t mask) const noexcept {
+        uint64_t const* w = words();
+        for (size_t i = first_word, n = words_.size(); i < n; ++i, mask = ~uint64_t(0)) {
+            if (uint64_t m = w[i] & mask) {
+                return i * bits + lowest_bit(m);
+            }
+        }
+        return npos;
+    }
+
+    template <typename Op>
+    socow_vector& combine(socow_vector const& that, Op op) {
+        if (size_ != that.size_) {
+            throw std::invalid_argument("socow_vector<bool>: size mismatch");
+        }
+        if (size_ == 0) {
+            return *this;
+        }
+        socow_vector keep = that;
+        uint64_t const* src = keep.words();
+        uint64_t* dst = words_.data();
+        for (size_t i = 0, n = words_.size(); i != n; ++i) {
+            dst[i] = op(dst[i], src[i]);
+        }
+        return *this;
+    }
+
+    size_t hash() const {
+        return std::hash<words_type>()(words_) ^ size_;
+    }
+
+    words_type words_;
+    size_t size_;
+};
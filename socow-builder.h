@@ -0,0 +1,148 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "socow-vector.h"
+
+// Collects elements from many producer threads. Appends claim slots of a
+// pre-sized block with a single fetch_add; once the block is full, each
+// thread appends to a chunk of its own. seal() must run after every
+// producer has finished and adopts the block in O(1) unless chunks had to
+// be used, in which case their elements are copied after it. The order of
+// elements appended by different threads is unspecified.
+template <typename T>
+struct socow_concurrent_builder {
+    static_assert(std::is_nothrow_copy_constructible<T>::value,
+                  "a failed copy would leave a hole in the shared block");
+
+    explicit socow_concurrent_builder(size_t capacity)
+        : block_(capacity == 0 ? nullptr : storage::allocate(capacity)), capacity_(capacity),
+          id_(next_id().fetch_add(1, std::memory_order_relaxed)) {}
+
+    socow_concurrent_builder(socow_concurrent_builder const&) = delete;
+    socow_concurrent_builder& operator=(socow_concurrent_builder const&) = delete;
+
+    ~socow_concurrent_builder() {
+        release_block();
+    }
+
+    void push_back(T const& e) {
+        append(&e, 1);
+    }
+
+    void append(T const* p, size_t n) {
+        size_t start = next_.fetch_add(n, std::memory_order_relaxed);
+        size_t fits = start >= capacity_ ? 0 : std::min(n, capacity_ - start);
+        T* data = fits == 0 ? nullptr : block_->data();
+        for (size_t i = 0; i != fits; ++i) {
+            new(data + start + i) T(p[i]);
+        }
+        if (fits != n) {
+            std::vector<T>& chunk = local_chunk();
+            chunk.insert(chunk.end(), p + fits, p + n);
+        }
+    }
+
+    // Exact once producers have finished.
+    size_t size() const {
+        size_t result = filled();
+        std::lock_guard<std::mutex> lock(chunks_mutex_);
+        for (auto const& c : chunks_) {
+            result += c->items.size();
+        }
+        return result;
+    }
+
+    // Leaves the builder empty and without a block, so that any later
+    // append goes to a chunk.
+    template <size_t SMALL_SIZE>
+    socow_vector<T, SMALL_SIZE> seal() {
+        size_t n = filled();
+        socow_vector<T, SMALL_SIZE> result;
+        if (n > SMALL_SIZE) {
+            result = socow_vector<T, SMALL_SIZE>(block_, n);
+            block_ = nullptr;
+        } else {
+            for (size_t i = 0; i != n; ++i) {
+                result.push_back(block_->data()[i]);
+            }
+        }
+        for (auto const& c : chunks_) {
+            for (T const& e : c->items) {
+                result.push_back(e);
+            }
+        }
+        release_block();
+        capacity_ = 0;
+        next_.store(0, std::memory_order_relaxed);
+        chunks_.clear();
+        id_ = next_id().fetch_add(1, std::memory_order_relaxed);
+        return result;
+    }
+
+private:
+    using content = socow_detail::content<T>;
+    using storage = socow_detail::storage<T>;
+
+    struct chunk {
+        std::thread::id owner;
+        std::vector<T> items;
+    };
+
+    struct cached_chunk {
+        uint64_t builder = 0;
+        std::vector<T>* items = nullptr;
+    };
+
+    static std::atomic<uint64_t>& next_id() {
+        static std::atomic<uint64_t> id{1};
+        return id;
+    }
+
+    size_t filled() const noexcept {
+        return std::min(next_.load(std::memory_order_relaxed), capacity_);
+    }
+
+    std::vector<T>& local_chunk() {
+        thread_local cached_chunk cache;
+        if (cache.builder == id_) {
+            return *cache.items;
+        }
+        std::thread::id self = std::this_thread::get_id();
+        std::lock_guard<std::mutex> lock(chunks_mutex_);
+        auto it = std::find_if(chunks_.begin(), chunks_.end(),
+                               [&](std::unique_ptr<chunk> const& c) { return c->owner == self; });
+        if (it == chunks_.end()) {
+            chunks_.push_back(std::unique_ptr<chunk>(new chunk{self, {}}));
+            it = chunks_.end() - 1;
+        }
+        cache.builder = id_;
+        cache.items = &(*it)->items;
+        return *cache.items;
+    }
+
+    void release_block() noexcept {
+        if (block_ != nullptr) {
+            T* p = block_->data();
+            for (size_t i = filled(); i != 0; --i) {
+                p[i - 1].~T();
+            }
+            storage last(block_);
+            block_ = nullptr;
+        }
+    }
+
+    content* block_;
+    size_t capacity_;
+    std::atomic<size_t> next_{0};
+    uint64_t id_;
+    mutable std::mutex chunks_mutex_;
+    std::vector<std::unique_ptr<chunk>> chunks_;
+};
@@ -0,0 +1,323 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "socow-vector.h"
+
+namespace socow_flat_detail {
+// The loop body has no data-dependent branch: the comparison only selects
+// the next base, which compiles to a conditional move.
+template <typename K>
+size_t lower_bound(K const* base, size_t n, K const& key) {
+    if (n == 0) {
+        return 0;
+    }
+    K const* p = base;
+    while (n > 1) {
+        size_t half = n / 2;
+        p = p[half] < key ? p + half : p;
+        n -= half;
+    }
+    return static_cast<size_t>(p - base) + (*p < key);
+}
+} // namespace socow_flat_detail
+
+// Sorted unique keys in a socow_vector. Copies share the block, so taking a
+// snapshot is O(1).
+template <typename K, size_t SMALL_SIZE>
+struct socow_flat_set {
+    using const_iterator = K const*;
+
+    socow_flat_set() noexcept = default;
+
+    size_t size() const noexcept {
+        return keys_.size();
+    }
+
+    bool empty() const noexcept {
+        return keys_.empty();
+    }
+
+    const_iterator begin() const noexcept {
+        return keys_.begin();
+    }
+
+    const_iterator end() const noexcept {
+        return keys_.end();
+    }
+
+    const_iterator find(K const& key) const {
+        size_t i = position(key);
+        return i != size() && !(key < keys_[i]) ? begin() + i : end();
+    }
+
+    bool contains(K const& key) const {
+        return find(key) != end();
+    }
+
+    size_t count(K const& key) const {
+        return contains(key) ? 1 : 0;
+    }
+
+    bool insert(K const& key) {
+        size_t i = position(key);
+        if (i != size() && !(key < as_const()[i])) {
+            return false;
+        }
+        keys_.insert(keys_.begin() + i, key);
+        return true;
+    }
+
+    // Sorts the new keys and merges them with the current ones into a
+    // single new block.
+    template <typename It>
+    void insert(It first, It last) {
+        std::vector<K> incoming(first, last);
+        if (incoming.empty()) {
+            return;
+        }
+        std::sort(incoming.begin(), incoming.end());
+        incoming.erase(std::unique(incoming.begin(), incoming.end(),
+                                   [](K const& a, K const& b) { return !(a < b); }),
+                       incoming.end());
+        socow_vector<K, SMALL_SIZE> merged;
+        merged.reserve(size() + incoming.size());
+        K const* a = begin();
+        K const* a_end = end();
+        auto b = incoming.cbegin();
+        while (a != a_end || b != incoming.cend()) {
+            if (b == incoming.cend() || (a != a_end && !(*b < *a))) {
+                if (b != incoming.cend() && !(*a < *b)) {
+                    ++b;
+                }
+                merged.push_back(*a++);
+            } else {
+                merged.push_back(*b++);
+            }
+        }
+        keys_.swap(merged);
+    }
+
+    bool erase(K const& key) {
+        size_t i = position(key);
+        if (i == size() || key < as_const()[i]) {
+            return false;
+        }
+        keys_.erase(keys_.begin() + i);
+        return true;
+    }
+
+    void clear() noexcept {
+        keys_.clear();
+    }
+
+    void swap(socow_flat_set& that) {
+        keys_.swap(that.keys_);
+    }
+
+    socow_vector<K, SMALL_SIZE> const& keys() const noexcept {
+        return keys_;
+    }
+
+    friend bool operator==(socow_flat_set const& a, socow_flat_set const& b) {
+        return a.keys_ == b.keys_;
+    }
+
+    friend bool operator!=(socow_flat_set const& a, socow_flat_set const& b) {
+        return !(a == b);
+    }
+
+private:
+    socow_vector<K, SMALL_SIZE> const& as_const() const noexcept {
+        return keys_;
+    }
+
+    size_t position(K const& key) const {
+        return socow_flat_detail::lower_bound(begin(), size(), key);
+    }
+
+    socow_vector<K, SMALL_SIZE> keys_;
+};
+
+// Sorted unique keys with their values in a parallel socow_vector. Lookups
+// touch only the key block, and writing through a value detaches only the
+// value block.
+template <typename K, typename V, size_t SMALL_SIZE>
+struct socow_flat_map {
+    socow_flat_map() noexcept = default;
+
+    size_t size() const noexcept {
+        return keys_.size();
+    }
+
+    bool empty() const noexcept {
+        return keys_.empty();
+    }
+
+    V const* find(K const& key) const {
+        size_t i = index_of(key);
+        return i == size() ? nullptr : &const_values()[i];
+    }
+
+    V* find(K const& key) {
+        size_t i = index_of(key);
+        return i == size() ? nullptr : &values_[i];
+    }
+
+    bool contains(K const& key) const {
+        return index_of(key) != size();
+    }
+
+    V const& at(K const& key) const {
+        V const* v = find(key);
+        if (v == nullptr) {
+            throw std::out_of_range("socow_flat_map: no such key");
+        }
+        return *v;
+    }
+
+    V& at(K const& key) {
+        V* v = find(key);
+        if (v == nullptr) {
+            throw std::out_of_range("socow_flat_map: no such key");
+        }
+        return *v;
+    }
+
+    // Leaves an existing value untouched.
+    bool insert(K const& key, V const& value) {
+        size_t i = position(key);
+        if (i != size() && !(key < const_keys()[i])) {
+            return false;
+        }
+        insert_at(i, key, value);
+        return true;
+    }
+
+    bool insert_or_assign(K const& key, V const& value) {
+        size_t i = position(key);
+        if (i != size() && !(key < const_keys()[i])) {
+            values_[i] = value;
+            return false;
+        }
+        insert_at(i, key, value);
+        return true;
+    }
+
+    // Like insert for each pair in turn: existing keys and the first of
+    // several equal new keys win. The new pairs are sorted and merged with
+    // the current ones into a single new block per column.
+    template <typename It>
+    void insert(It first, It last) {
+        std::vector<std::pair<K, V>> incoming(first, last);
+        if (incoming.empty()) {
+            return;
+        }
+        auto by_key = [](std::pair<K, V> const& a, std::pair<K, V> const& b) { return a.first < b.first; };
+        std::stable_sort(incoming.begin(), incoming.end(), by_key);
+        incoming.erase(std::unique(incoming.begin(), incoming.end(),
+                                   [](std::pair<K, V> const& a, std::pair<K, V> const& b) {
+                                       return !(a.first < b.first);
+                                   }),
+                       incoming.end());
+        socow_vector<K, SMALL_SIZE> keys;
+        socow_vector<V, SMALL_SIZE> values;
+        keys.reserve(size() + incoming.size());
+        values.reserve(size() + incoming.size());
+        K const* k = const_keys().begin();
+        V const* v = const_values().begin();
+        size_t a = 0;
+        auto b = incoming.cbegin();
+        while (a != size() || b != incoming.cend()) {
+            if (b == incoming.cend() || (a != size() && !(b->first < k[a]))) {
+                if (b != incoming.cend() && !(k[a] < b->first)) {
+                    ++b;
+                }
+                keys.push_back(k[a]);
+                values.push_back(v[a]);
+                ++a;
+            } else {
+                keys.push_back(b->first);
+                values.push_back(b->second);
+                ++b;
+            }
+        }
+        keys_.swap(keys);
+        values_.swap(values);
+    }
+
+    // Both columns are detached before either is changed, so a failed
+    // copy leaves the map as it was.
+    bool erase(K const& key) {
+        size_t i = index_of(key);
+        if (i == size()) {
+            return false;
+        }
+        keys_.data();
+        values_.data();
+        values_.erase(values_.begin() + i);
+        keys_.erase(keys_.begin() + i);
+        return true;
+    }
+
+    void clear() noexcept {
+        keys_.clear();
+        values_.clear();
+    }
+
+    void swap(socow_flat_map& that) {
+        keys_.swap(that.keys_);
+        values_.swap(that.values_);
+    }
+
+    socow_vector<K, SMALL_SIZE> const& keys() const noexcept {
+        return keys_;
+    }
+
+    socow_vector<V, SMALL_SIZE> const& values() const noexcept {
+        return values_;
+    }
+
+    friend bool operator==(socow_flat_map const& a, socow_flat_map const& b) {
+        return a.keys_ == b.keys_ && a.values_ == b.values_;
+    }
+
+    friend bool operator!=(socow_flat_map const& a, socow_flat_map const& b) {
+        return !(a == b);
+    }
+
+private:
+    socow_vector<K, SMALL_SIZE> const& const_keys() const noexcept {
+        return keys_;
+    }
+
+    socow_vector<V, SMALL_SIZE> const& const_values() const noexcept {
+        return values_;
+    }
+
+    size_t position(K const& key) const {
+        return socow_flat_detail::lower_bound(const_keys().begin(), size(), key);
+    }
+
+    size_t index_of(K const& key) const {
+        size_t i = position(key);
+        return i != size() && !(key < const_keys()[i]) ? i : size();
+    }
+
+    void insert_at(size_t i, K const& key, V const& value) {
+        keys_.insert(keys_.begin() + i, key);
+        try {
+            values_.insert(values_.begin() + i, value);
+        } catch (...) {
+            keys_.erase(keys_.begin() + i);
+            throw;
+        }
+    }
+
+    socow_vector<K, SMALL_SIZE> keys_;
+    socow_vector<V, SMALL_SIZE> values_;
+};
@@ -0,0 +1,74 @@
+#pragma once
+#include <cstddef>
+#include <unordered_set>
+
+#include "socow-vector.h"
+
+// Deduplicates heap blocks of equal vectors. The table holds a reference to
+// every interned block; evict() drops the blocks nothing else refers to any
+// more and runs on its own whenever the table has doubled since the last
+// sweep. Like socow_vector itself, a table must not be used concurrently.
+template <typename T, size_t SMALL_SIZE>
+struct socow_intern_table {
+    using vector = socow_vector<T, SMALL_SIZE>;
+
+    // Makes v share the block of an equal interned vector and returns true,
+    // or interns v's own block and returns false. Vectors stored inline are
+    // left alone.
+    bool intern(vector& v) {
+        if (v.small) {
+            return false;
+        }
+        auto it = blocks_.find(v);
+        if (it != blocks_.end()) {
+            if (!shares(*it, v)) {
+                v = *it;
+            }
+            return true;
+        }
+        if (v.dynamic_storage.unique()) {
+            v.shrink_to_fit();
+            if (v.small) {
+                return false;
+            }
+        }
+        blocks_.insert(v);
+        if (blocks_.size() >= sweep_at_) {
+            evict();
+            sweep_at_ = blocks_.size() * 2 < min_sweep ? min_sweep : blocks_.size() * 2;
+        }
+        return false;
+    }
+
+    size_t evict() {
+        size_t evicted = 0;
+        for (auto it = blocks_.begin(); it != blocks_.end();) {
+            if (it->dynamic_storage.content_ptr->ref_counter == 1) {
+                it = blocks_.erase(it);
+                ++evicted;
+            } else {
+                ++it;
+            }
+        }
+        return evicted;
+    }
+
+    size_t size() const noexcept {
+        return blocks_.size();
+    }
+
+    void clear() noexcept {
+        blocks_.clear();
+        sweep_at_ = min_sweep;
+    }
+
+private:
+    static constexpr size_t min_sweep = 64;
+
+    static bool shares(vector const& a, vector const& b) noexcept {
+        return a.dynamic_storage.content_ptr == b.dynamic_storage.content_ptr;
+    }
+
+    std::unordered_set<vector> blocks_;
+    size_t sweep_at_ = min_sweep;
+};
@@ -0,0 +1,167 @@
+#pragma once
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "socow-vector.h"
+
+// Binary format: a 32-byte header followed by size * element_size bytes of
+// element data in host byte order. A reader rejects a record whose element
+// size or alignment differs from its own T.
+struct socow_io {
+    static constexpr uint32_t magic = 0x31564353; // "SCV1"
+    static constexpr uint32_t version = 1;
+
+    struct header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t element_size;
+        uint32_t element_align;
+        uint64_t size;
+        uint64_t reserved;
+    };
+
+    static_assert(sizeof(header) == 32, "header layout is part of the format");
+
+    template <typename T, size_t SMALL_SIZE>
+    static header make_header(socow_vector<T, SMALL_SIZE> const& v) noexcept {
+        return header{magic, version, sizeof(T), alignof(T), v.size(), 0};
+    }
+
+    template <typename T>
+    static void check_header(header const& h) {
+        if (h.magic != magic) {
+            throw std::runtime_error("socow_io: bad magic");
+        }
+        if (h.version == 0 || h.version > version) {
+            throw std::runtime_error("socow_io: unsupported version");
+        }
+        if (h.element_size != sizeof(T) || h.element_align != alignof(T)) {
+            throw std::runtime_error("socow_io: element type mismatch");
+        }
+    }
+
+    template <typename T, size_t SMALL_SIZE>
+    static void write(int fd, socow_vector<T, SMALL_SIZE> const& v) {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "only trivially copyable elements can be serialized");
+        header h = make_header(v);
+        iovec iov[2] = {{&h, sizeof(h)},
+                        {const_cast<T*>(v.data()), v.size() * sizeof(T)}};
+        write_all(fd, iov, v.empty() ? 1 : 2);
+    }
+
+    // Writes all vectors of [first, last) with as few writev calls as
+    // IOV_MAX allows.
+    template <typename It>
+    static void write_batch(int fd, It first, It last) {
+        std::vector<header> headers;
+        for (It it = first; it != last; ++it) {
+            auto const& v = *it;
+            headers.push_back(make_header(v));
+        }
+        std::vector<iovec> iov;
+        iov.reserve(headers.size() * 2);
+        size_t i = 0;
+        for (It it = first; it != last; ++it, ++i) {
+            auto const& v = *it;
+            using T = std::remove_const_t<std::remove_pointer_t<decltype(v.data())>>;
+            static_assert(std::is_trivially_copyable<T>::value,
+                          "only trivially copyable elements can be serialized");
+            iov.push_back({&headers[i], sizeof(header)});
+            if (!v.empty()) {
+                iov.push_back({const_cast<T*>(v.data()), v.size() * sizeof(T)});
+            }
+        }
+        write_all(fd, iov.data(), iov.size());
+    }
+
+    template <typename Vector>
+    static Vector read(int fd) {
+        using T = std::remove_const_t<std::remove_pointer_t<decltype(std::declval<Vector const&>().data())>>;
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "only trivially copyable elements can be serialized");
+        header h;
+        read_all(fd, &h, sizeof(h));
+        check_header<T>(h);
+        if (h.size > (SIZE_MAX - sizeof(socow_detail::content<T>)) / sizeof(T)) {
+            throw std::runtime_error("socow_io: record too large");
+        }
+        if (h.size * sizeof(T) > available(fd)) {
+            throw std::runtime_error("socow_io: unexpected end of stream");
+        }
+        Vector result(static_cast<size_t>(h.size), typename Vector::uninitialized_t());
+        read_all(fd, const_cast<T*>(static_cast<Vector const&>(result).data()),
+                 static_cast<size_t>(h.size) * sizeof(T));
+        return result;
+    }
+
+private:
+    [[noreturn]] static void throw_errno(char const* what) {
+        throw std::system_error(errno, std::generic_category(), what);
+    }
+
+    // Bytes left after the current offset of a regular file; other files
+    // report no limit.
+    static uint64_t available(int fd) noexcept {
+        struct stat st;
+        if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+            return UINT64_MAX;
+        }
+        off_t pos = lseek(fd, 0, SEEK_CUR);
+        if (pos == -1 || pos > st.st_size) {
+            return UINT64_MAX;
+        }
+        return static_cast<uint64_t>(st.st_size - pos);
+    }
+
+    static void write_all(int fd, iovec* iov, size_t count) {
+        while (count != 0) {
+            int chunk = static_cast<int>(count < IOV_MAX ? count : IOV_MAX);
+            ssize_t written = ::writev(fd, iov, chunk);
+            if (written == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw_errno("writev");
+            }
+            size_t left = static_cast<size_t>(written);
+            while (count != 0 && left >= iov->iov_len) {
+                left -= iov->iov_len;
+                ++iov;
+                --count;
+            }
+            if (count != 0) {
+                iov->iov_base = static_cast<char*>(iov->iov_base) + left;
+                iov->iov_len -= left;
+            }
+        }
+    }
+
+    static void read_all(int fd, void* buf, size_t len) {
+        char* p = static_cast<char*>(buf);
+        while (len != 0) {
+            ssize_t got = ::read(fd, p, len);
+            if (got == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw_errno("read");
+            }
+            if (got == 0) {
+                throw std::runtime_error("socow_io: unexpected end of stream");
+            }
+            p += got;
+            len -= static_cast<size_t>(got);
+        }
+    }
+};
@@ -0,0 +1,242 @@
+#pragma once
+#include <cstddef>
+#include <initializer_list>
+#include <iterator>
+
+#include "socow-vector.h"
+
+// Rows of varying length flattened into one socow_vector of values and one
+// of row ends, instead of a heap block per row. Copies share both blocks, so
+// the whole structure is copied in O(1), and a write detaches it at most
+// once. SMALL_SIZE is the inline capacity of both vectors, so a structure
+// with at most SMALL_SIZE rows and values needs no heap block.
+template <typename T, size_t SMALL_SIZE>
+struct socow_jagged {
+    template <typename U>
+    struct span {
+        U* data_;
+        size_t size_;
+
+        U* begin() const noexcept {
+            return data_;
+        }
+        U* end() const noexcept {
+            return data_ + size_;
+        }
+        U* data() const noexcept {
+            return data_;
+        }
+        size_t size() const noexcept {
+            return size_;
+        }
+        bool empty() const noexcept {
+            return size_ == 0;
+        }
+        U& operator[](size_t i) const noexcept {
+            return data_[i];
+        }
+    };
+
+    // Walks the rows with plain pointers into both blocks, which stay valid
+    // until the container is modified.
+    class const_iterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = span<T const>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = span<T const>;
+
+        span<T const> operator*() const noexcept {
+            size_t first = row_ == 0 ? 0 : ends_[row_ - 1];
+            return {values_ + first, ends_[row_] - first};
+        }
+
+        const_iterator& operator++() noexcept {
+            ++row_;
+            return *this;
+        }
+
+        const_iterator operator++(int) noexcept {
+            const_iterator result = *this;
+            ++row_;
+            return result;
+        }
+
+        bool operator==(const_iterator const& that) const noexcept {
+            return row_ == that.row_;
+        }
+
+        bool operator!=(const_iterator const& that) const noexcept {
+            return row_ != that.row_;
+        }
+
+    private:
+        friend struct socow_jagged;
+
+        const_iterator(T const* values, size_t const* ends, size_t row) noexcept
+            : values_(values), ends_(ends), row_(row) {}
+
+        T const* values_;
+        size_t const* ends_;
+        size_t row_;
+    };
+
+    using values_type = socow_vector<T, SMALL_SIZE>;
+    using offsets_type = socow_vector<size_t, SMALL_SIZE>;
+
+    socow_jagged() noexcept = default;
+
+    template <size_t INNER, size_t OUTER>
+    explicit socow_jagged(socow_vector<socow_vector<T, INNER>, OUTER> const& nested) {
+        size_t total = 0;
+        for (socow_vector<T, INNER> const& row : nested) {
+            total += row.size();
+        }
+        values_.reserve(total);
+        offsets_.reserve(nested.size());
+        for (socow_vector<T, INNER> const& row : nested) {
+            for (T const& value : row) {
+                values_.push_back(value);
+            }
+            offsets_.push_back(values_.size());
+        }
+    }
+
+    template <size_t INNER, size_t OUTER>
+    socow_vector<socow_vector<T, INNER>, OUTER> to_nested() const {
+        socow_vector<socow_vector<T, INNER>, OUTER> result;
+        result.reserve(size());
+        for (span<T const> r : *this) {
+            socow_vector<T, INNER> row;
+            row.reserve(r.size());
+            for (T const& value : r) {
+                row.push_back(value);
+            }
+            result.push_back(row);
+        }
+        return result;
+    }
+
+    // Number of rows.
+    size_t size() const noexcept {
+        return offsets_.size();
+    }
+
+    bool empty() const noexcept {
+        return offsets_.empty();
+    }
+
+    size_t total_size() const noexcept {
+        return values_.size();
+    }
+
+    span<T const> operator[](size_t i) const {
+        offsets_type const& ends = offsets_;
+        size_t first = i == 0 ? 0 : ends[i - 1];
+        return {const_values().data() + first, ends[i] - first};
+    }
+
+    // Detaches a shared values block.
+    span<T> operator[](size_t i) {
+        offsets_type const& ends = offsets_;
+        size_t first = i == 0 ? 0 : ends[i - 1];
+        return {values_.data() + first, ends[i] - first};
+    }
+
+    const_iterator begin() const {
+        return const_iterator(const_values().data(), static_cast<offsets_type const&>(offsets_).data(), 0);
+    }
+
+    const_iterator end() const {
+        return const_iterator(nullptr, nullptr, size());
+    }
+
+    span<T const> back() const {
+        return (*this)[size() - 1];
+    }
+
+    void push_row() {
+        offsets_.push_back(values_.size());
+    }
+
+    // first and last must not point into this container.
+    template <typename It>
+    void push_row(It first, It last) {
+        size_t old = values_.size();
+        try {
+            for (; first != last; ++first) {
+                values_.push_back(*first);
+            }
+            offsets_.push_back(values_.size());
+        } catch (...) {
+            truncate_values(old);
+            throw;
+        }
+    }
+
+    void push_row(std::initializer_list<T> row) {
+        push_row(row.begin(), row.end());
+    }
+
+    // Appends a value to the last row, which must exist. The row ends are
+    // detached first, so a failed copy changes nothing.
+    void push_back(T const& value) {
+        size_t& end = offsets_[size() - 1];
+        values_.push_back(value);
+        ++end;
+    }
+
+    // Detaches the values first, for the same reason.
+    void pop_row() {
+        values_.data();
+        offsets_.pop_back();
+        truncate_values(empty() ? 0 : static_cast<offsets_type const&>(offsets_).back());
+    }
+
+    void reserve(size_t rows, size_t values) {
+        offsets_.reserve(rows);
+        values_.reserve(values);
+    }
+
+    void clear() noexcept {
+        values_.clear();
+        offsets_.clear();
+    }
+
+    void swap(socow_jagged& that) {
+        values_.swap(that.values_);
+        offsets_.swap(that.offsets_);
+    }
+
+    values_type const& values() const noexcept {
+        return values_;
+    }
+
+    // End of each row in values().
+    offsets_type const& offsets() const noexcept {
+        return offsets_;
+    }
+
+    friend bool operator==(socow_jagged const& a, socow_jagged const& b) {
+        return a.offsets_ == b.offsets_ && a.values_ == b.values_;
+    }
+
+    friend bool operator!=(socow_jagged const& a, socow_jagged const& b) {
+        return !(a == b);
+    }
+
+private:
+    values_type const& const_values() const noexcept {
+        return values_;
+    }
+
+    void truncate_values(size_t n) {
+        while (values_.size() != n) {
+            values_.pop_back();
+        }
+    }
+
+    values_type values_;
+    offsets_type offsets_;
+};
@@ -0,0 +1,269 @@
+#pragma once
+#include <cerrno>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "socow-io.h"
+#include "socow-vector.h"
+
+// Vectors whose heap block is a memory-mapped file in the socow_io format.
+//
+// open() maps the file MAP_PRIVATE: elements are paged in on demand, writes
+// to a uniquely owned vector land on private copies of the touched pages and
+// growth copies the vector to the heap. The file is never modified.
+//
+// open_writable() maps the file MAP_SHARED: writes go to the file and
+// push_back beyond capacity extends it with ftruncate and mremap. The element
+// count in the file header is only updated by sync(). Copies share the
+// mapping; the first one to be mutated while shared detaches to the heap.
+struct socow_mapped_file {
+    template <typename T, size_t SMALL_SIZE>
+    static socow_vector<T, SMALL_SIZE> open(std::string const& path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            throw_errno("open");
+        }
+        mapping<T> m = map<T>(fd, false);
+        if (m.size <= SMALL_SIZE) {
+            socow_vector<T, SMALL_SIZE> result;
+            for (size_t i = 0; i != m.size; ++i) {
+                result.push_back(m.elements()[i]);
+            }
+            m.unmap();
+            return result;
+        }
+        return socow_vector<T, SMALL_SIZE>(adopt(m), m.size);
+    }
+
+    template <typename T, size_t SMALL_SIZE>
+    static socow_vector<T, SMALL_SIZE> open_writable(std::string const& path) {
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd == -1) {
+            throw_errno("open");
+        }
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            fail(fd, "fstat");
+        }
+        if (st.st_size == 0) {
+            socow_io::header h{socow_io::magic, socow_io::version, sizeof(T), alignof(T), 0, 0};
+            if (pwrite(fd, &h, sizeof(h), 0) != static_cast<ssize_t>(sizeof(h))) {
+                fail(fd, "pwrite");
+            }
+        }
+        mapping<T> m = map<T>(fd, true);
+        if (m.capacity < SMALL_SIZE * 2 + 1) {
+            try {
+                m.resize(SMALL_SIZE * 2 + 1);
+            } catch (...) {
+                m.unmap();
+                throw;
+            }
+        }
+        return socow_vector<T, SMALL_SIZE>(adopt(m), m.size);
+    }
+
+    template <typename T, size_t SMALL_SIZE>
+    static bool is_mapped(socow_vector<T, SMALL_SIZE> const& v) noexcept {
+        return !v.small && v.dynamic_storage.content_ptr->ops_ == &mapping<T>::ops;
+    }
+
+    // Stores the element count of a vector returned by open_writable() in
+    // the file header and flushes the mapping.
+    template <typename T, size_t SMALL_SIZE>
+    static void sync(socow_vector<T, SMALL_SIZE> const& v) {
+        if (!is_mapped(v)) {
+            throw std::logic_error("socow_mapped_file: vector is not file-backed");
+        }
+        mapping<T>& m = mapping<T>::of(v.dynamic_storage.content_ptr);
+        if (!m.writable) {
+            throw std::logic_error("socow_mapped_file: mapping is read-only");
+        }
+        m.header()->size = v.size();
+        if (msync(m.base, m.length, MS_SYNC) == -1) {
+            throw_errno("msync");
+        }
+    }
+
+private:
+    static constexpr size_t data_offset = sizeof(socow_io::header);
+
+    template <typename T>
+    struct mapping {
+        using content = socow_detail::content<T>;
+
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "only trivially copyable elements can be file-backed");
+        static_assert(alignof(T) <= data_offset, "element alignment exceeds the header size");
+
+        int fd;
+        char* base;
+        size_t length;
+        size_t size;
+        size_t capacity;
+        bool writable;
+
+        socow_io::header* header() const noexcept {
+            return reinterpret_cast<socow_io::header*>(base);
+        }
+
+        T* elements() const noexcept {
+            return reinterpret_cast<T*>(base + data_offset);
+        }
+
+        void unmap() noexcept {
+            munmap(base, length);
+            close(fd);
+        }
+
+        void resize(size_t new_capacity) {
+            size_t new_length = data_offset + new_capacity * sizeof(T);
+            if (ftruncate(fd, static_cast<off_t>(new_length)) == -1) {
+                throw_errno("ftruncate");
+            }
+            void* p = mremap(base, length, new_length, MREMAP_MAYMOVE);
+            if (p == MAP_FAILED) {
+                throw_errno("mremap");
+            }
+            base = static_cast<char*>(p);
+            length = new_length;
+            capacity = new_capacity;
+        }
+
+        static mapping& of(content* c) noexcept {
+            return *reinterpret_cast<mapping*>(c->data_);
+        }
+
+        static void release(socow_detail::block_header* c) noexcept {
+            of(static_cast<content*>(c)).unmap();
+            operator delete(c, static_cast<std::align_val_t>(alignof(content)));
+        }
+
+        static bool grow(socow_detail::block_header* header, size_t new_capacity) {
+            content* c = static_cast<content*>(header);
+            mapping& m = of(c);
+            if (!m.writable) {
+                return false;
+            }
+            m.resize(new_capacity);
+            c->capacity_ = m.capacity;
+            c->set_data(m.elements());
+            return true;
+        }
+
+        static constexpr socow_detail::block_ops ops = {&release, &grow};
+    };
+
+    template <typename T>
+    static mapping<T> map(int fd, bool writable) {
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            fail(fd, "fstat");
+        }
+        size_t length = static_cast<size_t>(st.st_size);
+        socow_io::header h;
+        if (length < sizeof(h) || pread(fd, &h, sizeof(h), 0) != static_cast<ssize_t>(sizeof(h))) {
+            close(fd);
+            throw std::runtime_error("socow_mapped_file: truncated header");
+        }
+        try {
+            socow_io::check_header<T>(h);
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+        size_t capacity = (length - data_offset) / sizeof(T);
+        if (h.size > capacity) {
+            close(fd);
+            throw std::runtime_error("socow_mapped_file: truncated payload");
+        }
+        int prot = PROT_READ | PROT_WRITE;
+        void* p = mmap(nullptr, length, prot, writable ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            fail(fd, "mmap");
+        }
+        return mapping<T>{fd, static_cast<char*>(p), length, static_cast<size_t>(h.size), capacity, writable};
+    }
+
+    template <typename T>
+    static socow_detail::content<T>* adopt(mapping<T>& m) {
+        using content = socow_detail::content<T>;
+        void* memory;
+        try {
+            memory = operator new(sizeof(content) + sizeof(mapping<T>),
+                                  static_cast<std::align_val_t>(alignof(content)));
+        } catch (...) {
+            m.unmap();
+            throw;
+        }
+        content* c = content::place(memory, 1, m.capacity);
+        new(c->data_) mapping<T>(m);
+        c->set_data(m.elements());
+        c->ops_ = &mapping<T>::ops;
+        return c;
+    }
+
+    [[noreturn]] static void fail(int fd, char const* what) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        throw_errno(what);
+    }
+
+    [[noreturn]] static void throw_errno(char const* what) {
+        throw std::system_error(errno, std::generic_category(), what);
+    }
+};
+
+// Large zero-filled blocks, which socow_vector::resize() takes for
+// arithmetic, enum and pointer elements, are fresh anonymous mappings in
+// every program that includes this header: the kernel supplies their pages
+// on first touch, so untouched ranges cost neither time nor resident
+// memory. A mapping keeps its length in front of the header, at the start
+// of its first page.
+struct socow_zero_pages {
+    static constexpr size_t mapping_bytes = size_t(1) << 20;
+
+private:
+    static void* allocate(size_t bytes, size_t alignment, socow_detail::block_ops const*& ops) {
+        if (bytes < mapping_bytes || alignment >= page_size()) {
+            return nullptr;
+        }
+        size_t length = (bytes + alignment + page_size() - 1) / page_size() * page_size();
+        void* base = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        *static_cast<size_t*>(base) = length;
+        ops = &mapped_ops;
+        return static_cast<char*>(base) + alignment;
+    }
+
+    static size_t page_size() noexcept {
+        static size_t const size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        return size;
+    }
+
+    static void release(socow_detail::block_header* c) noexcept {
+        void* base = reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(c) & ~(page_size() - 1));
+        munmap(base, *static_cast<size_t*>(base));
+    }
+
+    static bool grow(socow_detail::block_header*, size_t) {
+        return false;
+    }
+
+    static constexpr socow_detail::block_ops mapped_ops = {&release, &grow};
+
+    static inline bool const installed =
+        (socow_detail::zeroed_allocate.store(&allocate, std::memory_order_relaxed), true);
+};
@@ -0,0 +1,190 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+
+#include "socow-vector.h"
+
+// Frame-of-reference bit packing for unsigned integers. Values are cut into
+// frames of 128; each frame stores its minimum and the bit width of the
+// largest difference from it, followed by the differences packed at that
+// width. A frame decodes independently with a branch-free loop, and its
+// [min, max] bound lets a search skip it without decoding. The encoding is
+// a sequence of 64-bit words: one two-word descriptor per frame, the packed
+// words of every frame, and a padding word that lets the decoder read one
+// word past the last frame.
+struct socow_packed {
+    static constexpr size_t frame_size = 128;
+
+    static constexpr size_t frames(size_t n) noexcept {
+        return (n + frame_size - 1) / frame_size;
+    }
+
+    // Number of words encode() writes for these values.
+    template <typename T>
+    static size_t encoded_words(T const* p, size_t n) noexcept {
+        size_t words = 2 * frames(n) + 1;
+        for (size_t f = 0; f != frames(n); ++f) {
+            T lo, hi;
+            bounds(p + f * frame_size, frame_count(n, f), lo, hi);
+            words += frame_words(frame_count(n, f), width(hi - lo));
+        }
+        return words;
+    }
+
+    template <typename T>
+    static void encode(T const* p, size_t n, uint64_t* out) noexcept {
+        static_assert(std::is_unsigned<T>::value && sizeof(T) <= 8, "only unsigned integers are packed");
+        uint64_t* descriptors = out;
+        uint64_t* words = out + 2 * frames(n);
+        size_t offset = 0;
+        for (size_t f = 0; f != frames(n); ++f) {
+            T const* values = p + f * frame_size;
+            size_t count = frame_count(n, f);
+            T lo, hi;
+            bounds(values, count, lo, hi);
+            unsigned w = width(hi - lo);
+            descriptors[2 * f] = lo;
+            descriptors[2 * f + 1] = (uint64_t(offset) << 8) | w;
+            uint64_t* frame = words + offset;
+            size_t total = frame_words(count, w);
+            for (size_t i = 0; i != total; ++i) {
+                frame[i] = 0;
+            }
+            for (size_t i = 0; i != count; ++i) {
+                uint64_t delta = uint64_t(values[i] - lo);
+                size_t bit = i * w;
+                frame[bit / 64] |= delta << (bit % 64);
+                if (bit % 64 + w > 64) {
+                    frame[bit / 64 + 1] |= delta >> (64 - bit % 64);
+                }
+            }
+            offset += total;
+        }
+        words[offset] = 0;
+    }
+
+    // Decodes frame f of an encoding of n values into out and returns the
+    // number of values written.
+    template <typename T>
+    static size_t decode_frame(uint64_t const* in, size_t n, size_t f, T* out) noexcept {
+        size_t count = frame_count(n, f);
+        uint64_t lo = in[2 * f];
+        unsigned w = static_cast<unsigned>(in[2 * f + 1] & 0xff);
+        if (w == 0) {
+            for (size_t i = 0; i != count; ++i) {
+                out[i] = static_cast<T>(lo);
+            }
+            return count;
+        }
+        uint64_t const* frame = in + 2 * frames(n) + (in[2 * f + 1] >> 8);
+        uint64_t mask = w == 64 ? ~uint64_t(0) : (uint64_t(1) << w) - 1;
+        for (size_t i = 0; i != count; ++i) {
+            size_t bit = i * w;
+            size_t s = bit % 64;
+            uint64_t v = (frame[bit / 64] >> s) | ((frame[bit / 64 + 1] << 1) << (63 - s));
+            out[i] = static_cast<T>(lo + (v & mask));
+        }
+        return count;
+    }
+
+    template <typename T>
+    static void decode(uint64_t const* in, size_t n, T* out) noexcept {
+        for (size_t f = 0; f != frames(n); ++f) {
+            decode_frame(in, n, f, out + f * frame_size);
+        }
+    }
+
+    // Whether frame f may hold value.
+    template <typename T>
+    static bool may_contain(uint64_t const* in, size_t f, T value) noexcept {
+        uint64_t lo = in[2 * f];
+        unsigned w = static_cast<unsigned>(in[2 * f + 1] & 0xff);
+        uint64_t delta = uint64_t(value) - lo;
+        return uint64_t(value) >= lo && (w == 64 || delta >> w == 0);
+    }
+
+private:
+    static constexpr size_t frame_count(size_t n, size_t f) noexcept {
+        return n - f * frame_size < frame_size ? n - f * frame_size : frame_size;
+    }
+
+    static constexpr size_t frame_words(size_t count, unsigned w) noexcept {
+        return (count * w + 63) / 64;
+    }
+
+    template <typename T>
+    static void bounds(T const* p, size_t count, T& lo, T& hi) noexcept {
+        lo = p[0];
+        hi = p[0];
+        for (size_t i = 1; i != count; ++i) {
+            lo = p[i] < lo ? p[i] : lo;
+            hi = p[i] > hi ? p[i] : hi;
+        }
+    }
+
+    static unsigned width(uint64_t range) noexcept {
+        unsigned w = 0;
+        for (; range != 0; range >>= 1) {
+            ++w;
+        }
+        return w;
+    }
+};
+
+namespace socow_detail {
+// The block socow_vector::compress() makes: the socow_packed words follow
+// the slot of the decoded copy.
+template <typename T>
+struct packed_block {
+    static_assert(codec_ops::frame_size == socow_packed::frame_size, "frames must line up");
+
+    using encoded = encoded_block<T>;
+
+    // Returns null when packing saves no space.
+    static content<T>* make(T const* p, size_t n) {
+        size_t words = socow_packed::encoded_words(p, n);
+        if (sizeof(uint64_t) * words >= sizeof(T) * n) {
+            return nullptr;
+        }
+        void* memory = operator new(sizeof(content<T>) + sizeof(typename encoded::slot) + sizeof(uint64_t) * words, static_cast<std::align_val_t>(alignof(content<T>)));
+        content<T>* c = content<T>::place(memory, 1, n);
+        new(c->data_) typename encoded::slot(nullptr);
+        socow_packed::encode(p, n, of(c));
+        c->ops_ = &ops;
+        return c;
+    }
+
+    static uint64_t const* of(content<T> const* c) noexcept {
+        return reinterpret_cast<uint64_t const*>(encoded::encoding(c));
+    }
+
+    static uint64_t* of(content<T>* c) noexcept {
+        return reinterpret_cast<uint64_t*>(encoded::encoding(c));
+    }
+
+    static size_t decode_frame(block_header const* c, size_t f, void* out) noexcept {
+        content<T> const* b = static_cast<content<T> const*>(c);
+        return socow_packed::decode_frame(of(b), b->capacity_, f, static_cast<T*>(out));
+    }
+
+    static bool may_contain(block_header const* c, size_t f, void const* value) noexcept {
+        return socow_packed::may_contain(of(static_cast<content<T> const*>(c)), f, *static_cast<T const*>(value));
+    }
+
+    static void release(block_header* c) noexcept {
+        if (content<T>* d = encoded::decoded(static_cast<content<T>*>(c)).load(std::memory_order_acquire)) {
+            drop(d, alignof(content<T>));
+        }
+        operator delete(c, static_cast<std::align_val_t>(alignof(content<T>)));
+    }
+
+    static bool grow(block_header*, size_t) {
+        return false;
+    }
+
+    static constexpr codec_ops codec = {&decode_frame, &may_contain};
+    static constexpr block_ops ops = {&release, &grow, false, &codec};
+};
+} // namespace socow_detail
@@ -0,0 +1,286 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "socow-simd.h"
+#include "socow-vector.h"
+
+// Opt-in parallel element copy for very large detaches and reallocations.
+// Ranges of at least threshold() bytes are split into chunks that run on an
+// internal thread pool or on a user-supplied executor. If a chunk throws,
+// every element constructed by the other chunks is destroyed before the
+// first exception is rethrown, so the destination is left empty.
+struct socow_parallel {
+    // Runs task(i) for every i in [0, count) and returns once all of them
+    // have finished. Tasks never throw.
+    using executor = std::function<void(size_t count, std::function<void(size_t)> const& task)>;
+
+    static constexpr size_t min_chunk_bytes = size_t(1) << 20;
+
+    // 0 disables parallel copies; this is the default. Otherwise
+    // socow_vector copies trivially copyable elements through copy().
+    static void set_threshold(size_t bytes) noexcept {
+        threshold_.store(bytes, std::memory_order_relaxed);
+        socow_detail::parallel_copy.store(bytes != 0 ? &split : nullptr, std::memory_order_relaxed);
+    }
+
+    static size_t threshold() noexcept {
+        return threshold_.load(std::memory_order_relaxed);
+    }
+
+    // Routes chunks to e, which is expected to run about concurrency of them
+    // at once. An empty executor restores the internal pool.
+    static void set_executor(executor e, size_t concurrency) {
+        std::lock_guard<std::mutex> lock(config_mutex());
+        user_executor() = std::move(e);
+        user_concurrency() = concurrency == 0 ? 1 : concurrency;
+    }
+
+    static bool worth_it(size_t bytes) noexcept {
+        size_t t = threshold();
+        return t != 0 && bytes >= t;
+    }
+
+    // Runs task on a worker of the internal pool without waiting for it, or
+    // right away when the pool has no workers. Tasks never throw.
+    static void submit(std::function<void()> task) {
+        pool::instance().submit(std::move(task));
+    }
+
+    template <typename T>
+    static void copy(T const* start, T const* ending, T* destination) {
+        size_t n = static_cast<size_t>(ending - start);
+        executor e;
+        size_t concurrency;
+        {
+            std::lock_guard<std::mutex> lock(config_mutex());
+            e = user_executor();
+            concurrency = e ? user_concurrency() : pool::instance().concurrency();
+        }
+        size_t chunks = std::min(concurrency, std::max<size_t>(1, n * sizeof(T) / min_chunk_bytes));
+        size_t per_chunk = (n + chunks - 1) / chunks;
+        bool stream = n * sizeof(T) >= socow_simd::streaming_threshold();
+
+        std::unique_ptr<bool[]> done(new bool[chunks]());
+        std::unique_ptr<std::exception_ptr[]> errors(new std::exception_ptr[chunks]);
+        std::atomic<bool> failed(false);
+        std::function<void(size_t)> task = [&](size_t i) {
+            size_t lo = std::min(n, i * per_chunk);
+            size_t hi = std::min(n, lo + per_chunk);
+            if (failed.load(std::memory_order_relaxed)) {
+                return;
+            }
+            try {
+                copy_chunk(start + lo, start + hi, destination + lo, stream);
+                done[i] = true;
+            } catch (...) {
+                errors[i] = std::current_exception();
+                failed.store(true, std::memory_order_relaxed);
+            }
+        };
+        if (e) {
+            e(chunks, task);
+        } else {
+            pool::instance().run(chunks, task);
+        }
+
+        if (failed.load(std::memory_order_relaxed)) {
+            std::exception_ptr first;
+            for (size_t i = 0; i != chunks; ++i) {
+                if (done[i]) {
+                    size_t lo = std::min(n, i * per_chunk);
+                    size_t hi = std::min(n, lo + per_chunk);
+                    destroy(destination + lo, destination + hi);
+                } else if (!first && errors[i]) {
+                    first = errors[i];
+                }
+            }
+            std::rethrow_exception(first);
+        }
+    }
+
+private:
+    static bool split(void* dst, void const* src, size_t n) {
+        if (!worth_it(n)) {
+            return false;
+        }
+        unsigned char const* from = static_cast<unsigned char const*>(src);
+        copy(from, from + n, static_cast<unsigned char*>(dst));
+        return true;
+    }
+
+    template <typename T>
+    static void copy_chunk(T const* start, T const* ending, T* destination, bool stream) {
+        if constexpr (std::is_trivially_copyable<T>::value) {
+            if (stream) {
+                socow_simd::stream_bytes(destination, start, sizeof(T) * (ending - start));
+            } else if (start != ending) {
+                std::memcpy(static_cast<void*>(destination), start, sizeof(T) * (ending - start));
+            }
+            return;
+        }
+        for (T const* it = start; it != ending; ++it) {
+            try {
+                new(destination + (it - start)) T(*it);
+            } catch (...) {
+                destroy(destination, destination + (it - start));
+                throw;
+            }
+        }
+    }
+
+    template <typename T>
+    static void destroy(T* start, T* ending) noexcept {
+        while (ending != start) {
+            (--ending)->~T();
+        }
+    }
+
+    class pool {
+    public:
+        static pool& instance() {
+            static pool p;
+            return p;
+        }
+
+        size_t concurrency() const noexcept {
+            return workers_.size() + 1;
+        }
+
+        void run(size_t count, std::function<void(size_t)> const& task) {
+            std::unique_lock<std::mutex> job(busy_, std::try_to_lock);
+            if (!job.owns_lock() || workers_.empty() || on_worker()) {
+                for (size_t i = 0; i != count; ++i) {
+                    task(i);
+                }
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                task_ = &task;
+                count_ = count;
+                next_.store(0, std::memory_order_relaxed);
+                active_ = workers_.size();
+                ++generation_;
+            }
+            wake_.notify_all();
+            work();
+            std::unique_lock<std::mutex> lock(mutex_);
+            finished_.wait(lock, [this] { return active_ == 0; });
+        }
+
+        void submit(std::function<void()> task) {
+            if (workers_.empty()) {
+                task();
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                background_.push_back(std::move(task));
+            }
+            wake_.notify_one();
+        }
+
+        ~pool() {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            wake_.notify_all();
+            for (std::thread& t : workers_) {
+                t.join();
+            }
+        }
+
+    private:
+        pool() {
+            unsigned hw = std::thread::hardware_concurrency();
+            size_t threads = hw > 1 ? std::min<size_t>(hw - 1, 7) : 0;
+            for (size_t i = 0; i != threads; ++i) {
+                workers_.emplace_back([this] { loop(); });
+            }
+        }
+
+        // A submitted task that copies in parallel must not wait for the
+        // worker it runs on.
+        static bool& on_worker() noexcept {
+            thread_local bool worker = false;
+            return worker;
+        }
+
+        void loop() {
+            on_worker() = true;
+            size_t seen = 0;
+            for (;;) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    wake_.wait(lock, [&] { return stop_ || generation_ != seen || !background_.empty(); });
+                    if (generation_ == seen && !background_.empty()) {
+                        std::function<void()> task = std::move(background_.front());
+                        background_.pop_front();
+                        lock.unlock();
+                        task();
+                        continue;
+                    }
+                    if (generation_ == seen) {
+                        return;
+                    }
+                    seen = generation_;
+                }
+                work();
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (--active_ == 0) {
+                    finished_.notify_one();
+                }
+            }
+        }
+
+        void work() {
+            for (size_t i; (i = next_.fetch_add(1, std::memory_order_relaxed)) < count_;) {
+                (*task_)(i);
+            }
+        }
+
+        std::mutex busy_;
+        std::mutex mutex_;
+        std::condition_variable wake_;
+        std::condition_variable finished_;
+        std::vector<std::thread> workers_;
+        std::deque<std::function<void()>> background_;
+        std::function<void(size_t)> const* task_ = nullptr;
+        size_t count_ = 0;
+        std::atomic<size_t> next_{0};
+        size_t active_ = 0;
+        size_t generation_ = 0;
+        bool stop_ = false;
+    };
+
+    static std::mutex& config_mutex() {
+        static std::mutex m;
+        return m;
+    }
+
+    static executor& user_executor() {
+        static executor e;
+        return e;
+    }
+
+    static size_t& user_concurrency() {
+        static size_t c = 1;
+        return c;
+    }
+
+    static inline std::atomic<size_t> threshold_{0};
+};
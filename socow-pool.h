@@ -0,0 +1,224 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <new>
+
+#include "socow-vector.h"
+
+// Optional cache of content blocks. Each thread keeps free lists of blocks
+// whose size is a power of two; a block freed on another thread is handed
+// back to the list of the thread that allocated it and picked up on its next
+// allocation. Blocks outliving their thread are freed directly. While the
+// pool is enabled, socow_vector takes its heap blocks from it.
+struct socow_block_pool {
+    static constexpr size_t alignment = 16;
+
+    static void set_enabled(bool enabled) noexcept {
+        enabled_.store(enabled, std::memory_order_relaxed);
+        socow_detail::pool_allocate.store(enabled ? &allocate_block : nullptr, std::memory_order_relaxed);
+    }
+
+    static bool enabled() noexcept {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    // Caps the number of cached blocks per size class and the largest block
+    // size taken from the pool.
+    static void set_limits(size_t max_blocks_per_class, size_t max_block_bytes) noexcept {
+        max_blocks_per_class_.store(max_blocks_per_class, std::memory_order_relaxed);
+        max_block_bytes_.store(max_block_bytes, std::memory_order_relaxed);
+    }
+
+    // Returns nullptr when the pool is disabled or the block is too large.
+    static void* allocate(size_t bytes) {
+        size_t total = bytes + alignment;
+        if (!enabled() || total > max_block_bytes_.load(std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        size_t size_class = class_of(total);
+        cache* self = local(true);
+        if (self->lists[size_class] == nullptr && self->has_remote.load(std::memory_order_acquire)) {
+            self->drain_remote();
+        }
+        void* base = self->lists[size_class];
+        if (base != nullptr) {
+            self->lists[size_class] = next(base);
+            self->counts[size_class]--;
+        } else {
+            base = operator new(size_t(1) << size_class, std::align_val_t(alignment));
+        }
+        new(base) prefix{self, size_class};
+        self->outstanding++;
+        return static_cast<char*>(base) + alignment;
+    }
+
+    static void deallocate(void* memory) noexcept {
+        void* base = static_cast<char*>(memory) - alignment;
+        prefix* p = static_cast<prefix*>(base);
+        cache* owner = p->owner;
+        if (owner == local(false)) {
+            owner->outstanding--;
+            owner->keep(base, p->size_class);
+            return;
+        }
+        std::unique_lock<std::mutex> lock(owner->mutex);
+        if (!owner->orphaned) {
+            next(base) = owner->remote;
+            owner->remote = base;
+            owner->has_remote.store(true, std::memory_order_release);
+            return;
+        }
+        operator delete(base, std::align_val_t(alignment));
+        if (--owner->outstanding == 0) {
+            lock.unlock();
+            delete owner;
+        }
+    }
+
+    // Frees every block cached by the calling thread.
+    static void trim() noexcept {
+        if (cache* self = local(false)) {
+            self->drain_remote();
+            self->release_all();
+        }
+    }
+
+    static size_t cached_blocks() noexcept {
+        size_t result = 0;
+        if (cache* self = local(false)) {
+            for (size_t count : self->counts) {
+                result += count;
+            }
+        }
+        return result;
+    }
+
+private:
+    static constexpr size_t class_count = sizeof(size_t) * 8;
+
+    static void* allocate_block(size_t bytes, size_t align, socow_detail::block_ops const*& ops) {
+        void* memory = align <= alignment ? allocate(bytes) : nullptr;
+        if (memory != nullptr) {
+            ops = &pooled_ops;
+        }
+        return memory;
+    }
+
+    static void release_block(socow_detail::block_header* c) noexcept {
+        deallocate(c);
+    }
+
+    static bool grow_block(socow_detail::block_header*, size_t) {
+        return false;
+    }
+
+    static constexpr socow_detail::block_ops pooled_ops = {&release_block, &grow_block, true};
+
+    struct cache;
+
+    struct prefix {
+        cache* owner;
+        size_t size_class;
+    };
+
+    static_assert(sizeof(prefix) <= alignment, "prefix must fit in the alignment gap");
+
+    struct cache {
+        void* lists[class_count] = {};
+        size_t counts[class_count] = {};
+        size_t outstanding = 0;
+        std::atomic<bool> has_remote{false};
+        std::mutex mutex;
+        void* remote = nullptr;
+        bool orphaned = false;
+
+        void keep(void* base, size_t size_class) noexcept {
+            if (counts[size_class] < max_blocks_per_class_.load(std::memory_order_relaxed)) {
+                next(base) = lists[size_class];
+                lists[size_class] = base;
+                counts[size_class]++;
+            } else {
+                operator delete(base, std::align_val_t(alignment));
+            }
+        }
+
+        void drain_remote() noexcept {
+            void* list;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                list = remote;
+                remote = nullptr;
+                has_remote.store(false, std::memory_order_relaxed);
+            }
+            while (list != nullptr) {
+                void* base = list;
+                list = next(list);
+                outstanding--;
+                keep(base, static_cast<prefix*>(base)->size_class);
+            }
+        }
+
+        void release_all() noexcept {
+            for (size_t i = 0; i != class_count; ++i) {
+                while (lists[i] != nullptr) {
+                    void* base = lists[i];
+                    lists[i] = next(base);
+                    operator delete(base, std::align_val_t(alignment));
+                }
+                counts[i] = 0;
+            }
+        }
+
+        void orphan() noexcept {
+            release_all();
+            std::unique_lock<std::mutex> lock(mutex);
+            orphaned = true;
+            while (remote != nullptr) {
+                void* base = remote;
+                remote = next(base);
+                outstanding--;
+                operator delete(base, std::align_val_t(alignment));
+            }
+            if (outstanding == 0) {
+                lock.unlock();
+                delete this;
+            }
+        }
+    };
+
+    struct local_cache {
+        cache* c = nullptr;
+
+        ~local_cache() {
+            if (c != nullptr) {
+                c->orphan();
+                c = nullptr;
+            }
+        }
+    };
+
+    static cache* local(bool create) {
+        thread_local local_cache holder;
+        if (holder.c == nullptr && create) {
+            holder.c = new cache;
+        }
+        return holder.c;
+    }
+
+    static void*& next(void* base) noexcept {
+        return *reinterpret_cast<void**>(static_cast<char*>(base) + alignment);
+    }
+
+    static size_t class_of(size_t bytes) noexcept {
+        size_t result = 6;
+        while ((size_t(1) << result) < bytes) {
+            ++result;
+        }
+        return result;
+    }
+
+    static inline std::atomic<bool> enabled_{false};
+    static inline std::atomic<size_t> max_blocks_per_class_{64};
+    static inline std::atomic<size_t> max_block_bytes_{size_t(1) << 20};
+};
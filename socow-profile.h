@@ -0,0 +1,291 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <new>
+#include <tuple>
+#include <vector>
+
+template <typename T, size_t SMALL_SIZE>
+struct socow_vector;
+
+// Sampled size statistics for picking SMALL_SIZE. socow_vector reports to
+// it only when SOCOW_PROFILE is defined, which must then hold in every
+// translation unit. While enabled, one in sample_period() constructed
+// vectors is tracked until it is destroyed: its final and peak sizes go to
+// the histograms of its instantiation and call-site tag, together with the
+// number of moves from the inline buffer to the heap and back. A tracked
+// vector keeps its own record, so only construction and destruction take
+// the global lock.
+struct socow_profile {
+    // Sizes above exact_limit are rounded down to a power of two.
+    static constexpr size_t exact_limit = 1024;
+
+    using histogram = std::map<size_t, size_t>;
+
+    struct stats {
+        std::string type;
+        std::string site;
+        size_t element_size = 0;
+        size_t small_size = 0;
+        size_t block_overhead = 0;
+        size_t objects = 0;
+        size_t promotions = 0;
+        size_t demotions = 0;
+        histogram final_sizes;
+        histogram peak_sizes;
+    };
+
+    enum class goal { memory, allocations };
+
+    // Totals over the sampled objects, counting the inline buffer and every
+    // heap block a vector would allocate while growing to its peak size.
+    struct recommendation {
+        size_t small_size = 0;
+        size_t bytes = 0;
+        size_t allocations = 0;
+    };
+
+    // Tags vectors constructed on this thread while the scope is alive.
+    class scope {
+    public:
+        explicit scope(char const* site) noexcept
+            : previous_(current_site()) {
+            current_site() = site;
+        }
+
+        ~scope() {
+            current_site() = previous_;
+        }
+
+        scope(scope const&) = delete;
+        scope& operator=(scope const&) = delete;
+
+    private:
+        char const* previous_;
+    };
+
+    static void set_enabled(bool enabled) noexcept {
+        enabled_.store(enabled, std::memory_order_relaxed);
+    }
+
+    static bool enabled() noexcept {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    static void set_sample_period(size_t period) noexcept {
+        period_.store(period == 0 ? 1 : period, std::memory_order_relaxed);
+    }
+
+    static size_t sample_period() noexcept {
+        return period_.load(std::memory_order_relaxed);
+    }
+
+    // Statistics of the objects destroyed so far, one entry per
+    // instantiation and tag.
+    static std::vector<stats> snapshot() {
+        state& s = get();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        std::vector<stats> result;
+        for (auto const& entry : s.sites) {
+            if (entry.second.objects != 0) {
+                result.push_back(entry.second);
+            }
+        }
+        return result;
+    }
+
+    // Objects still alive stay tracked and report when they are destroyed.
+    static void reset() {
+        state& s = get();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        for (auto& entry : s.sites) {
+            stats& st = entry.second;
+            st.objects = st.promotions = st.demotions = 0;
+            st.final_sizes.clear();
+            st.peak_sizes.clear();
+        }
+    }
+
+    // The SMALL_SIZE up to max_small_size with the least total for the
+    // goal; ties go to fewer bytes, then to the smaller size.
+    static recommendation recommend(stats const& st, goal g, size_t max_small_size = 256) {
+        recommendation best;
+        bool found = false;
+        for (size_t n = 1; n <= max_small_size; ++n) {
+            recommendation r = evaluate(st, n);
+            bool better = g == goal::memory
+                              ? r.bytes < best.bytes
+                              : r.allocations < best.allocations ||
+                                    (r.allocations == best.allocations && r.bytes < best.bytes);
+            if (!found || better) {
+                best = r;
+                found = true;
+            }
+        }
+        return best;
+    }
+
+    // Totals for the sampled objects had they used SMALL_SIZE n.
+    static recommendation evaluate(stats const& st, size_t n) {
+        recommendation r;
+        r.small_size = n;
+        for (auto const& bucket : st.peak_sizes) {
+            size_t peak = bucket.first;
+            size_t count = bucket.second;
+            size_t bytes = n * st.element_size;
+            size_t allocations = 0;
+            if (peak > n) {
+                size_t capacity = n * 2;
+                allocations = 1;
+                while (capacity < peak) {
+                    capacity *= 2;
+                    ++allocations;
+                }
+                bytes += st.block_overhead + capacity * st.element_size;
+            }
+            r.bytes += bytes * count;
+            r.allocations += allocations * count;
+        }
+        return r;
+    }
+
+    static void report(std::ostream& out, size_t max_small_size = 256) {
+        for (stats const& st : snapshot()) {
+            recommendation current = evaluate(st, st.small_size);
+            recommendation memory = recommend(st, goal::memory, max_small_size);
+            recommendation allocations = recommend(st, goal::allocations, max_small_size);
+            out << st.type << " SMALL_SIZE=" << st.small_size;
+            if (!st.site.empty()) {
+                out << " [" << st.site << "]";
+            }
+            out << ": " << st.objects << " objects, " << st.promotions << " promotions, " << st.demotions
+                << " demotions; peak size p50=" << percentile(st.peak_sizes, 50)
+                << " p90=" << percentile(st.peak_sizes, 90) << " max=" << percentile(st.peak_sizes, 100)
+                << "; final size p50=" << percentile(st.final_sizes, 50) << '\n';
+            out << "  current " << st.small_size << ": " << current.bytes << " bytes, " << current.allocations
+                << " allocations\n";
+            out << "  least memory " << memory.small_size << ": " << memory.bytes << " bytes, "
+                << memory.allocations << " allocations\n";
+            out << "  fewest allocations " << allocations.small_size << ": " << allocations.bytes << " bytes, "
+                << allocations.allocations << " allocations\n";
+        }
+    }
+
+    // The smallest size at or above the given percentage of the samples.
+    static size_t percentile(histogram const& h, size_t percent) {
+        size_t total = 0;
+        for (auto const& bucket : h) {
+            total += bucket.second;
+        }
+        size_t seen = 0;
+        for (auto const& bucket : h) {
+            seen += bucket.second;
+            if (seen * 100 >= total * percent) {
+                return bucket.first;
+            }
+        }
+        return 0;
+    }
+
+private:
+    template <typename T, size_t SMALL_SIZE>
+    friend struct socow_vector;
+
+    // Owned by the sampled vector until untrack.
+    struct tracked {
+        stats* site;
+        size_t peak;
+        size_t promotions;
+        size_t demotions;
+
+        void resized(size_t size) noexcept {
+            if (size > peak) {
+                peak = size;
+            }
+        }
+
+        void moved(bool to_heap) noexcept {
+            ++(to_heap ? promotions : demotions);
+        }
+    };
+
+    struct state {
+        std::mutex mutex;
+        std::map<std::tuple<std::string, size_t, std::string>, stats> sites;
+    };
+
+    // Never destroyed, so vectors with static storage duration may report
+    // during exit.
+    static state& get() {
+        static state* s = new state;
+        return *s;
+    }
+
+    static char const*& current_site() noexcept {
+        thread_local char const* site = nullptr;
+        return site;
+    }
+
+    static size_t bucket(size_t size) noexcept {
+        if (size <= exact_limit) {
+            return size;
+        }
+        size_t result = exact_limit;
+        while (result <= size / 2) {
+            result *= 2;
+        }
+        return result;
+    }
+
+    static bool sample() noexcept {
+        return enabled() && counter_.fetch_add(1, std::memory_order_relaxed) % sample_period() == 0;
+    }
+
+    // Returns nullptr when out of memory; the vector then goes untracked.
+    static tracked* track(char const* type, size_t element_size, size_t small_size, size_t block_overhead,
+                          size_t size) noexcept {
+        try {
+            state& s = get();
+            char const* site = current_site();
+            std::lock_guard<std::mutex> lock(s.mutex);
+            auto key = std::make_tuple(std::string(type), small_size, std::string(site ? site : ""));
+            stats& st = s.sites[key];
+            if (st.type.empty()) {
+                st.type = type;
+                st.site = site ? site : "";
+                st.element_size = element_size;
+                st.small_size = small_size;
+                st.block_overhead = block_overhead;
+            }
+            return new tracked{&st, size, 0, 0};
+        } catch (...) {
+            return nullptr;
+        }
+    }
+
+    static void untrack(tracked* t, size_t size) noexcept {
+        t->resized(size);
+        {
+            state& s = get();
+            std::lock_guard<std::mutex> lock(s.mutex);
+            stats& st = *t->site;
+            st.promotions += t->promotions;
+            st.demotions += t->demotions;
+            try {
+                st.final_sizes[bucket(size)]++;
+                st.peak_sizes[bucket(t->peak)]++;
+                st.objects++;
+            } catch (...) {
+            }
+        }
+        delete t;
+    }
+
+    static inline std::atomic<bool> enabled_{false};
+    static inline std::atomic<size_t> period_{64};
+    static inline std::atomic<size_t> counter_{0};
+};
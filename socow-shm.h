@@ -0,0 +1,270 @@
+#pragma once
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "socow-vector.h"
+
+// Blocks published into a segment are frozen: their reference counter is
+// never touched, so other processes may map the segment read-only, and any
+// mutation of an attached vector detaches it into process-local heap.
+// Attached vectors must not outlive the segment mapping they were attached
+// from.
+struct socow_shm_segment {
+    static socow_shm_segment create(std::string const& name, size_t size) {
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd == -1) {
+            throw_errno("shm_open");
+        }
+        try {
+            return socow_shm_segment(fd, size);
+        } catch (...) {
+            shm_unlink(name.c_str());
+            throw;
+        }
+    }
+
+    static socow_shm_segment create_anonymous(size_t size) {
+        int fd = memfd_create("socow-vector", MFD_CLOEXEC);
+        if (fd == -1) {
+            throw_errno("memfd_create");
+        }
+        return socow_shm_segment(fd, size);
+    }
+
+    static socow_shm_segment open(std::string const& name) {
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd == -1) {
+            throw_errno("shm_open");
+        }
+        return socow_shm_segment(fd);
+    }
+
+    static socow_shm_segment open_fd(int fd) {
+        int own = dup(fd);
+        if (own == -1) {
+            throw_errno("dup");
+        }
+        return socow_shm_segment(own);
+    }
+
+    static void unlink(std::string const& name) {
+        if (shm_unlink(name.c_str()) == -1) {
+            throw_errno("shm_unlink");
+        }
+    }
+
+    socow_shm_segment(socow_shm_segment&& that) noexcept
+        : fd_(that.fd_), base_(that.base_), size_(that.size_),
+          writable_(that.writable_) {
+        that.fd_ = -1;
+        that.base_ = nullptr;
+        that.size_ = 0;
+    }
+
+    socow_shm_segment& operator=(socow_shm_segment&& that) noexcept {
+        if (this != &that) {
+            socow_shm_segment tmp(std::move(that));
+            std::swap(fd_, tmp.fd_);
+            std::swap(base_, tmp.base_);
+            std::swap(size_, tmp.size_);
+            std::swap(writable_, tmp.writable_);
+        }
+        return *this;
+    }
+
+    socow_shm_segment(socow_shm_segment const&) = delete;
+    socow_shm_segment& operator=(socow_shm_segment const&) = delete;
+
+    ~socow_shm_segment() {
+        if (base_ != nullptr) {
+            munmap(base_, size_);
+        }
+        if (fd_ != -1) {
+            close(fd_);
+        }
+    }
+
+    int fd() const noexcept {
+        return fd_;
+    }
+
+    size_t size() const noexcept {
+        return size_;
+    }
+
+    size_t used() const noexcept {
+        return header()->used.load(std::memory_order_acquire);
+    }
+
+    bool writable() const noexcept {
+        return writable_;
+    }
+
+    template <typename T, size_t SMALL_SIZE>
+    size_t publish(socow_vector<T, SMALL_SIZE> const& v) {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "only trivially copyable elements can be shared "
+                      "between processes");
+        if (!writable_) {
+            throw std::logic_error("socow_shm_segment: segment is read-only");
+        }
+        using content = socow_detail::content<T>;
+        size_t bytes = content_offset<T>() + sizeof(content) + sizeof(T) * v.size();
+        size_t offset = allocate(bytes, block_align<T>());
+
+        published_header* block = new(base_ + offset) published_header;
+        block->size = v.size();
+        block->element_size = sizeof(T);
+        block->element_align = alignof(T);
+
+        content* c = content::place(base_ + offset + content_offset<T>(), content::frozen, v.size());
+        if (!v.empty()) {
+            std::memcpy(c->data(), v.data(), sizeof(T) * v.size());
+        }
+        return offset;
+    }
+
+    template <typename T, size_t SMALL_SIZE>
+    socow_vector<T, SMALL_SIZE> attach(size_t offset) const {
+        static_assert(std::is_trivially_copyable<T>::value,
+                      "only trivially copyable elements can be shared "
+                      "between processes");
+        using content = socow_detail::content<T>;
+        if (offset % block_align<T>() != 0 || offset < sizeof(segment_header) ||
+            offset + content_offset<T>() + sizeof(content) > size_) {
+            throw std::out_of_range("socow_shm_segment: bad block offset");
+        }
+        published_header const* block = reinterpret_cast<published_header const*>(base_ + offset);
+        if (block->element_size != sizeof(T) || block->element_align != alignof(T)) {
+            throw std::invalid_argument("socow_shm_segment: element type mismatch");
+        }
+        size_t size = block->size;
+        if (size > (size_ - offset - content_offset<T>() - sizeof(content)) / sizeof(T)) {
+            throw std::out_of_range("socow_shm_segment: block exceeds segment");
+        }
+
+        content* c = reinterpret_cast<content*>(base_ + offset + content_offset<T>());
+        if (size <= SMALL_SIZE) {
+            socow_vector<T, SMALL_SIZE> result;
+            for (size_t i = 0; i != size; ++i) {
+                result.push_back(c->data()[i]);
+            }
+            return result;
+        }
+        return socow_vector<T, SMALL_SIZE>(c, size);
+    }
+
+private:
+    static constexpr uint64_t magic = 0x77766f636f73ULL;
+
+    struct segment_header {
+        uint64_t magic;
+        uint64_t size;
+        std::atomic<uint64_t> used;
+    };
+
+    // Precedes the content block of each published vector.
+    struct published_header {
+        uint64_t size;
+        uint32_t element_size;
+        uint32_t element_align;
+    };
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                  "segment allocation needs an address-free atomic");
+
+    socow_shm_segment(int fd, size_t size) : fd_(fd), writable_(true) {
+        size_ = size < sizeof(segment_header) ? sizeof(segment_header) : size;
+        if (ftruncate(fd_, static_cast<off_t>(size_)) == -1) {
+            fail("ftruncate");
+        }
+        map(PROT_READ | PROT_WRITE);
+        segment_header* h = new(base_) segment_header;
+        h->magic = magic;
+        h->size = size_;
+        h->used.store(sizeof(segment_header), std::memory_order_release);
+    }
+
+    explicit socow_shm_segment(int fd) : fd_(fd), writable_(false) {
+        struct stat st;
+        if (fstat(fd_, &st) == -1) {
+            fail("fstat");
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ < sizeof(segment_header)) {
+            close(fd_);
+            throw std::invalid_argument("socow_shm_segment: not a segment");
+        }
+        map(PROT_READ);
+        if (header()->magic != magic || header()->size != size_) {
+            munmap(base_, size_);
+            close(fd_);
+            throw std::invalid_argument("socow_shm_segment: not a segment");
+        }
+    }
+
+    void map(int prot) {
+        void* p = mmap(nullptr, size_, prot, MAP_SHARED, fd_, 0);
+        if (p == MAP_FAILED) {
+            fail("mmap");
+        }
+        base_ = static_cast<char*>(p);
+    }
+
+    [[noreturn]] void fail(char const* what) {
+        int err = errno;
+        close(fd_);
+        errno = err;
+        throw_errno(what);
+    }
+
+    [[noreturn]] static void throw_errno(char const* what) {
+        throw std::system_error(errno, std::generic_category(), what);
+    }
+
+    segment_header* header() const noexcept {
+        return reinterpret_cast<segment_header*>(base_);
+    }
+
+    template <typename T>
+    static constexpr size_t block_align() {
+        size_t a = alignof(socow_detail::content<T>);
+        return a < alignof(published_header) ? alignof(published_header) : a;
+    }
+
+    template <typename T>
+    static constexpr size_t content_offset() {
+        return (sizeof(published_header) + block_align<T>() - 1) / block_align<T>() * block_align<T>();
+    }
+
+    size_t allocate(size_t bytes, size_t align) {
+        std::atomic<uint64_t>& used = header()->used;
+        uint64_t current = used.load(std::memory_order_relaxed);
+        uint64_t start;
+        do {
+            start = (current + align - 1) / align * align;
+            if (start > size_ || bytes > size_ - start) {
+                throw std::bad_alloc();
+            }
+        } while (!used.compare_exchange_weak(current, start + bytes,
+                                             std::memory_order_acq_rel));
+        return static_cast<size_t>(start);
+    }
+
+    int fd_;
+    char* base_ = nullptr;
+    size_t size_ = 0;
+    bool writable_;
+};
@@ -0,0 +1,425 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__unix__)
+#include <unistd.h>
+#endif
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SOCOW_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+#include "socow-vector.h"
+
+namespace socow_simd {
+using socow_detail::lane_t;
+using socow_detail::load;
+
+inline bool has_avx2() noexcept {
+#ifdef SOCOW_SIMD_X86
+    static bool const result = __builtin_cpu_supports("avx2");
+    return result;
+#else
+    return false;
+#endif
+}
+
+#ifdef SOCOW_SIMD_X86
+inline __m128i splat128(uint8_t v) noexcept {
+    return _mm_set1_epi8(static_cast<char>(v));
+}
+inline __m128i splat128(uint16_t v) noexcept {
+    return _mm_set1_epi16(static_cast<short>(v));
+}
+inline __m128i splat128(uint32_t v) noexcept {
+    return _mm_set1_epi32(static_cast<int>(v));
+}
+inline __m128i splat128(uint64_t v) noexcept {
+    return _mm_set1_epi64x(static_cast<long long>(v));
+}
+inline __m128i splat128(float v) noexcept {
+    return _mm_castps_si128(_mm_set1_ps(v));
+}
+inline __m128i splat128(double v) noexcept {
+    return _mm_castpd_si128(_mm_set1_pd(v));
+}
+
+inline __m128i eq128(__m128i a, __m128i b, uint8_t) noexcept {
+    return _mm_cmpeq_epi8(a, b);
+}
+inline __m128i eq128(__m128i a, __m128i b, uint16_t) noexcept {
+    return _mm_cmpeq_epi16(a, b);
+}
+inline __m128i eq128(__m128i a, __m128i b, uint32_t) noexcept {
+    return _mm_cmpeq_epi32(a, b);
+}
+inline __m128i eq128(__m128i a, __m128i b, uint64_t) noexcept {
+    __m128i eq = _mm_cmpeq_epi32(a, b);
+    return _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+}
+inline __m128i eq128(__m128i a, __m128i b, float) noexcept {
+    return _mm_castps_si128(_mm_cmpeq_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b)));
+}
+inline __m128i eq128(__m128i a, __m128i b, double) noexcept {
+    return _mm_castpd_si128(_mm_cmpeq_pd(_mm_castsi128_pd(a), _mm_castsi128_pd(b)));
+}
+
+__attribute__((target("avx2"))) inline __m256i splat256(uint8_t v) noexcept {
+    return _mm256_set1_epi8(static_cast<char>(v));
+}
+__attribute__((target("avx2"))) inline __m256i splat256(uint16_t v) noexcept {
+    return _mm256_set1_epi16(static_cast<short>(v));
+}
+__attribute__((target("avx2"))) inline __m256i splat256(uint32_t v) noexcept {
+    return _mm256_set1_epi32(static_cast<int>(v));
+}
+__attribute__((target("avx2"))) inline __m256i splat256(uint64_t v) noexcept {
+    return _mm256_set1_epi64x(static_cast<long long>(v));
+}
+__attribute__((target("avx2"))) inline __m256i splat256(float v) noexcept {
+    return _mm256_castps_si256(_mm256_set1_ps(v));
+}
+__attribute__((target("avx2"))) inline __m256i splat256(double v) noexcept {
+    return _mm256_castpd_si256(_mm256_set1_pd(v));
+}
+
+__attribute__((target("avx2"))) inline __m256i eq256(__m256i a, __m256i b, uint8_t) noexcept {
+    return _mm256_cmpeq_epi8(a, b);
+}
+__attribute__((target("avx2"))) inline __m256i eq256(__m256i a, __m256i b, uint16_t) noexcept {
+    return _mm256_cmpeq_epi16(a, b);
+}
+__attribute__((target("avx2"))) inline __m256i eq256(__m256i a, __m256i b, uint32_t) noexcept {
+    return _mm256_cmpeq_epi32(a, b);
+}
+__attribute__((target("avx2"))) inline __m256i eq256(__m256i a, __m256i b, uint64_t) noexcept {
+    return _mm256_cmpeq_epi64(a, b);
+}
+__attribute__((target("avx2"))) inline __m256i eq256(__m256i a, __m256i b, float) noexcept {
+    return _mm256_castps_si256(
+        _mm256_cmp_ps(_mm256_castsi256_ps(a), _mm256_castsi256_ps(b), _CMP_EQ_OQ));
+}
+__attribute__((target("avx2"))) inline __m256i eq256(__m256i a, __m256i b, double) noexcept {
+    return _mm256_castpd_si256(
+        _mm256_cmp_pd(_mm256_castsi256_pd(a), _mm256_castsi256_pd(b), _CMP_EQ_OQ));
+}
+
+template <typename L>
+size_t find_sse2(void const* p, size_t n, L value) noexcept {
+    char const* bytes = static_cast<char const*>(p);
+    size_t const step = 16 / sizeof(L);
+    __m128i needle = splat128(value);
+    size_t i = 0;
+    for (; i + step <= n; i += step) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<__m128i const*>(bytes + i * sizeof(L)));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(eq128(x, needle, L())));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask) / sizeof(L);
+        }
+    }
+    for (; i < n; ++i) {
+        if (load<L>(p, i) == value) {
+            return i;
+        }
+    }
+    return n;
+}
+
+template <typename L>
+__attribute__((target("avx2"))) size_t find_avx2(void const* p, size_t n, L value) noexcept {
+    char const* bytes = static_cast<char const*>(p);
+    size_t const step = 32 / sizeof(L);
+    __m256i needle = splat256(value);
+    size_t i = 0;
+    for (; i + step <= n; i += step) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(bytes + i * sizeof(L)));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(eq256(x, needle, L())));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask) / sizeof(L);
+        }
+    }
+    for (; i < n; ++i) {
+        if (load<L>(p, i) == value) {
+            return i;
+        }
+    }
+    return n;
+}
+
+template <typename L>
+size_t count_sse2(void const* p, size_t n, L value) noexcept {
+    char const* bytes = static_cast<char const*>(p);
+    size_t const step = 16 / sizeof(L);
+    __m128i needle = splat128(value);
+    size_t result = 0;
+    size_t i = 0;
+    for (; i + step <= n; i += step) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<__m128i const*>(bytes + i * sizeof(L)));
+        result += __builtin_popcount(_mm_movemask_epi8(eq128(x, needle, L())));
+    }
+    result /= sizeof(L);
+    for (; i < n; ++i) {
+        result += load<L>(p, i) == value;
+    }
+    return result;
+}
+
+template <typename L>
+__attribute__((target("avx2"))) size_t count_avx2(void const* p, size_t n, L value) noexcept {
+    char const* bytes = static_cast<char const*>(p);
+    size_t const step = 32 / sizeof(L);
+    __m256i needle = splat256(value);
+    size_t result = 0;
+    size_t i = 0;
+    for (; i + step <= n; i += step) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(bytes + i * sizeof(L)));
+        result += __builtin_popcount(_mm256_movemask_epi8(eq256(x, needle, L())));
+    }
+    result /= sizeof(L);
+    for (; i < n; ++i) {
+        result += load<L>(p, i) == value;
+    }
+    return result;
+}
+
+template <typename L>
+size_t mismatch_sse2(void const* a, void const* b, size_t n) noexcept {
+    char const* x = static_cast<char const*>(a);
+    char const* y = static_cast<char const*>(b);
+    size_t const step = 16 / sizeof(L);
+    size_t i = 0;
+    for (; i + step <= n; i += step) {
+        __m128i u = _mm_loadu_si128(reinterpret_cast<__m128i const*>(x + i * sizeof(L)));
+        __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(y + i * sizeof(L)));
+        unsigned mask = ~static_cast<unsigned>(_mm_movemask_epi8(eq128(u, v, L()))) & 0xffffu;
+        if (mask != 0) {
+            return i + __builtin_ctz(mask) / sizeof(L);
+        }
+    }
+    for (; i < n; ++i) {
+        if (!(load<L>(a, i) == load<L>(b, i))) {
+            return i;
+        }
+    }
+    return n;
+}
+
+template <typename L>
+__attribute__((target("avx2"))) size_t mismatch_avx2(void const* a, void const* b, size_t n) noexcept {
+    char const* x = static_cast<char const*>(a);
+    char const* y = static_cast<char const*>(b);
+    size_t const step = 32 / sizeof(L);
+    size_t i = 0;
+    for (; i + step <= n; i += step) {
+        __m256i u = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(x + i * sizeof(L)));
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(y + i * sizeof(L)));
+        unsigned mask = ~static_cast<unsigned>(_mm256_movemask_epi8(eq256(u, v, L())));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask) / sizeof(L);
+        }
+    }
+    for (; i < n; ++i) {
+        if (!(load<L>(a, i) == load<L>(b, i))) {
+            return i;
+        }
+    }
+    return n;
+}
+#endif
+
+template <typename T>
+size_t find(T const* p, size_t n, T const& value) {
+    using L = lane_t<T>;
+    if constexpr (std::is_void<L>::value) {
+        for (size_t i = 0; i != n; ++i) {
+            if (p[i] == value) {
+                return i;
+            }
+        }
+        return n;
+    } else {
+        L v = load<L>(&value, 0);
+#ifdef SOCOW_SIMD_X86
+        return has_avx2() ? find_avx2<L>(p, n, v) : find_sse2<L>(p, n, v);
+#else
+        for (size_t i = 0; i != n; ++i) {
+            if (load<L>(p, i) == v) {
+                return i;
+            }
+        }
+        return n;
+#endif
+    }
+}
+
+template <typename T>
+size_t count(T const* p, size_t n, T const& value) {
+    using L = lane_t<T>;
+    if constexpr (std::is_void<L>::value) {
+        size_t result = 0;
+        for (size_t i = 0; i != n; ++i) {
+            result += p[i] == value;
+        }
+        return result;
+    } else {
+        L v = load<L>(&value, 0);
+#ifdef SOCOW_SIMD_X86
+        return has_avx2() ? count_avx2<L>(p, n, v) : count_sse2<L>(p, n, v);
+#else
+        size_t result = 0;
+        for (size_t i = 0; i != n; ++i) {
+            result += load<L>(p, i) == v;
+        }
+        return result;
+#endif
+    }
+}
+
+// Index of the first position where a[i] == b[i] does not hold.
+template <typename T>
+size_t mismatch(T const* a, T const* b, size_t n) {
+    using L = lane_t<T>;
+    if constexpr (std::is_void<L>::value) {
+        for (size_t i = 0; i != n; ++i) {
+            if (!(a[i] == b[i])) {
+                return i;
+            }
+        }
+        return n;
+    } else {
+#ifdef SOCOW_SIMD_X86
+        return has_avx2() ? mismatch_avx2<L>(a, b, n) : mismatch_sse2<L>(a, b, n);
+#else
+        for (size_t i = 0; i != n; ++i) {
+            if (!(load<L>(a, i) == load<L>(b, i))) {
+                return i;
+            }
+        }
+        return n;
+#endif
+    }
+}
+
+template <typename T>
+bool equal(T const* a, T const* b, size_t n) {
+    using L = lane_t<T>;
+    if constexpr (std::is_integral<L>::value) {
+        return n == 0 || std::memcmp(a, b, n * sizeof(T)) == 0;
+    } else {
+        return mismatch(a, b, n) == n;
+    }
+}
+
+inline size_t last_level_cache_size() noexcept {
+    static size_t const result = [] {
+        long size = 0;
+#if defined(_SC_LEVEL3_CACHE_SIZE)
+        size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+        if (size <= 0) {
+            size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+        }
+#endif
+        return size > 0 ? static_cast<size_t>(size) : size_t(8) << 20;
+    }();
+    return result;
+}
+
+inline std::atomic<size_t>& streaming_threshold_value() noexcept {
+    static std::atomic<size_t> value{last_level_cache_size() / 2};
+    return value;
+}
+
+// Copies of at least this many bytes bypass the cache.
+inline size_t streaming_threshold() noexcept {
+    return streaming_threshold_value().load(std::memory_order_relaxed);
+}
+
+// Sets the streaming threshold to a fraction of the last-level cache; a
+// fraction of 0 or less turns streaming off.
+inline void set_streaming_fraction(double fraction) noexcept {
+    size_t threshold = fraction > 0 ? static_cast<size_t>(fraction * last_level_cache_size()) : SIZE_MAX;
+    streaming_threshold_value().store(threshold, std::memory_order_relaxed);
+}
+
+// memcpy with non-temporal stores: the destination is written around the
+// cache and the source is prefetched with a non-temporal hint, so a copy
+// much larger than the cache does not evict the working set.
+inline void stream_bytes(void* dst, void const* src, size_t n) noexcept {
+#ifdef SOCOW_SIMD_X86
+    char* d = static_cast<char*>(dst);
+    char const* s = static_cast<char const*>(src);
+    size_t head = (16 - reinterpret_cast<uintptr_t>(d) % 16) % 16;
+    if (head > n) {
+        head = n;
+    }
+    std::memcpy(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+    for (; n >= 64; n -= 64, d += 64, s += 64) {
+        _mm_prefetch(s + 512, _MM_HINT_NTA);
+        __m128i x0 = _mm_loadu_si128(reinterpret_cast<__m128i const*>(s));
+        __m128i x1 = _mm_loadu_si128(reinterpret_cast<__m128i const*>(s + 16));
+        __m128i x2 = _mm_loadu_si128(reinterpret_cast<__m128i const*>(s + 32));
+        __m128i x3 = _mm_loadu_si128(reinterpret_cast<__m128i const*>(s + 48));
+        _mm_stream_si128(reinterpret_cast<__m128i*>(d), x0);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(d + 16), x1);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(d + 32), x2);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(d + 48), x3);
+    }
+    _mm_sfence();
+    std::memcpy(d, s, n);
+#else
+    std::memcpy(dst, src, n);
+#endif
+}
+
+inline void copy_bytes(void* dst, void const* src, size_t n) noexcept {
+    if (n >= streaming_threshold()) {
+        stream_bytes(dst, src, n);
+    } else if (n != 0) {
+        std::memcpy(dst, src, n);
+    }
+}
+
+#ifdef SOCOW_SIMD_X86
+template <typename L>
+struct vector_scans {
+    static size_t find(void const* p, size_t n, L value) noexcept {
+        return has_avx2() ? find_avx2<L>(p, n, value) : find_sse2<L>(p, n, value);
+    }
+
+    static size_t count(void const* p, size_t n, L value) noexcept {
+        return has_avx2() ? count_avx2<L>(p, n, value) : count_sse2<L>(p, n, value);
+    }
+
+    static size_t mismatch(void const* a, void const* b, size_t n) noexcept {
+        return has_avx2() ? mismatch_avx2<L>(a, b, n) : mismatch_sse2<L>(a, b, n);
+    }
+
+    static constexpr socow_detail::scan_ops<L> ops = {&find, &count, &mismatch};
+};
+#endif
+
+// Every program that includes this header has socow_vector scan and copy
+// through the functions above.
+inline bool install() noexcept {
+#ifdef SOCOW_SIMD_X86
+    socow_detail::scans<uint8_t>.store(&vector_scans<uint8_t>::ops, std::memory_order_relaxed);
+    socow_detail::scans<uint16_t>.store(&vector_scans<uint16_t>::ops, std::memory_order_relaxed);
+    socow_detail::scans<uint32_t>.store(&vector_scans<uint32_t>::ops, std::memory_order_relaxed);
+    socow_detail::scans<uint64_t>.store(&vector_scans<uint64_t>::ops, std::memory_order_relaxed);
+    socow_detail::scans<float>.store(&vector_scans<float>::ops, std::memory_order_relaxed);
+    socow_detail::scans<double>.store(&vector_scans<double>::ops, std::memory_order_relaxed);
+#endif
+    socow_detail::stream_copy.store(&copy_bytes, std::memory_order_relaxed);
+    return true;
+}
+
+inline bool const installed = install();
+} // namespace socow_simd
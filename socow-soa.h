@@ -0,0 +1,130 @@
+#pragma once
+#include <cstddef>
+#include <tuple>
+#include <utility>
+
+#include "socow-vector.h"
+
+// Rows of Ts... stored column by column. Each column is a socow_vector with
+// its own inline buffer and heap block, so copies share every column and a
+// write detaches only the column it touches.
+template <size_t SMALL_SIZE, typename... Ts>
+struct socow_soa_vector {
+    static_assert(sizeof...(Ts) != 0, "a row needs at least one column");
+
+    template <typename T>
+    struct span {
+        T* data_;
+        size_t size_;
+
+        T* begin() const noexcept {
+            return data_;
+        }
+        T* end() const noexcept {
+            return data_ + size_;
+        }
+        T* data() const noexcept {
+            return data_;
+        }
+        size_t size() const noexcept {
+            return size_;
+        }
+        T& operator[](size_t i) const noexcept {
+            return data_[i];
+        }
+    };
+
+    template <size_t I>
+    using column_type = std::tuple_element_t<I, std::tuple<Ts...>>;
+
+    size_t size() const noexcept {
+        return std::get<0>(columns_).size();
+    }
+
+    bool empty() const noexcept {
+        return size() == 0;
+    }
+
+    void push_back(Ts const&... values) {
+        push_from<0>(values...);
+    }
+
+    void pop_back() {
+        std::apply([](auto&... c) { (c.data(), ...); }, columns_);
+        pop_from<0>();
+    }
+
+    void clear() noexcept {
+        std::apply([](auto&... c) { (c.clear(), ...); }, columns_);
+    }
+
+    void swap(socow_soa_vector& that) {
+        std::apply([&](auto&... c) {
+            std::apply([&](auto&... d) { (c.swap(d), ...); }, that.columns_);
+        }, columns_);
+    }
+
+    std::tuple<Ts...> row(size_t i) const {
+        return std::apply([i](auto const&... c) { return std::tuple<Ts...>(c[i]...); }, columns_);
+    }
+
+    template <size_t I>
+    column_type<I> const& get(size_t i) const noexcept {
+        return std::get<I>(columns_)[i];
+    }
+
+    template <size_t I>
+    column_type<I>& get(size_t i) {
+        return std::get<I>(columns_)[i];
+    }
+
+    template <size_t I>
+    span<column_type<I> const> column() const noexcept {
+        auto const& c = std::get<I>(columns_);
+        return {c.data(), c.size()};
+    }
+
+    // Detaches column I if it is shared; the other columns stay shared.
+    template <size_t I>
+    span<column_type<I>> column() {
+        auto& c = std::get<I>(columns_);
+        return {c.data(), c.size()};
+    }
+
+    template <size_t I>
+    socow_vector<column_type<I>, SMALL_SIZE> const& column_vector() const noexcept {
+        return std::get<I>(columns_);
+    }
+
+    friend bool operator==(socow_soa_vector const& a, socow_soa_vector const& b) {
+        return a.columns_ == b.columns_;
+    }
+
+    friend bool operator!=(socow_soa_vector const& a, socow_soa_vector const& b) {
+        return !(a == b);
+    }
+
+private:
+    template <size_t I, typename U, typename... Us>
+    void push_from(U const& value, Us const&... rest) {
+        std::get<I>(columns_).push_back(value);
+        if constexpr (sizeof...(Us) != 0) {
+            try {
+                push_from<I + 1>(rest...);
+            } catch (...) {
+                std::get<I>(columns_).pop_back();
+                throw;
+            }
+        }
+    }
+
+    template <size_t I>
+    void pop_from() noexcept {
+        std::get<I>(columns_).pop_back();
+        if constexpr (I + 1 != sizeof...(Ts)) {
+            pop_from<I + 1>();
+        }
+    }
+
+    std::tuple<socow_vector<Ts, SMALL_SIZE>...> columns_;
+};
@@ -0,0 +1,227 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+
+#include "socow-simd.h"
+#include "socow-vector.h"
+
+// A null-terminated string on top of socow_vector: strings of up to
+// SMALL_SIZE characters live inline, longer ones share a heap block, so
+// copies are O(1) and strings sharing a block compare equal in O(1). The
+// terminator is stored as the last element of a non-empty buffer.
+template <typename CharT, size_t SMALL_SIZE>
+struct socow_string {
+    using traits_type = std::char_traits<CharT>;
+    using view_type = std::basic_string_view<CharT>;
+    using const_iterator = CharT const*;
+
+    static constexpr size_t npos = view_type::npos;
+
+    socow_string() noexcept = default;
+
+    socow_string(CharT const* s)
+        : socow_string(s, traits_type::length(s)) {}
+
+    socow_string(CharT const* s, size_t n) {
+        append(s, n);
+    }
+
+    explicit socow_string(view_type s)
+        : socow_string(s.data(), s.size()) {}
+
+    size_t size() const noexcept {
+        return chars_.empty() ? 0 : chars_.size() - 1;
+    }
+
+    size_t length() const noexcept {
+        return size();
+    }
+
+    bool empty() const noexcept {
+        return chars_.empty();
+    }
+
+    CharT const* c_str() const noexcept {
+        static CharT const terminator = CharT();
+        return chars_.empty() ? &terminator : chars_.data();
+    }
+
+    CharT const* data() const noexcept {
+        return c_str();
+    }
+
+    const_iterator begin() const noexcept {
+        return c_str();
+    }
+
+    const_iterator end() const noexcept {
+        return c_str() + size();
+    }
+
+    CharT const& operator[](size_t i) const noexcept {
+        return c_str()[i];
+    }
+
+    // Detaches a shared buffer.
+    CharT& operator[](size_t i) {
+        return chars_[i];
+    }
+
+    operator view_type() const noexcept {
+        return view_type(c_str(), size());
+    }
+
+    void push_back(CharT c) {
+        append(&c, 1);
+    }
+
+    void pop_back() {
+        chars_.pop_back();
+        if (chars_.size() == 1) {
+            chars_.pop_back();
+        } else {
+            chars_[chars_.size() - 1] = CharT();
+        }
+    }
+
+    socow_string& append(CharT const* s, size_t n) {
+        if (n == 0) {
+            return *this;
+        }
+        CharT const* own = c_str();
+        if (!std::less<CharT const*>()(s, own) && std::less<CharT const*>()(s, own + size())) {
+            socow_string tmp(s, n);
+            return append(tmp.data(), n);
+        }
+        size_t old = chars_.size();
+        chars_.reserve(old + n + (old == 0));
+        if (old != 0) {
+            chars_.pop_back();
+        }
+        try {
+            for (size_t i = 0; i != n; ++i) {
+                chars_.push_back(s[i]);
+            }
+            chars_.push_back(CharT());
+        } catch (...) {
+            while (chars_.size() + 1 > old && !chars_.empty()) {
+                chars_.pop_back();
+            }
+            if (old != 0) {
+                chars_.push_back(CharT());
+            }
+            throw;
+        }
+        return *this;
+    }
+
+    socow_string& append(view_type s) {
+        return append(s.data(), s.size());
+    }
+
+    socow_string& operator+=(view_type s) {
+        return append(s);
+    }
+
+    socow_string& operator+=(CharT c) {
+        return append(&c, 1);
+    }
+
+    void clear() noexcept {
+        chars_.clear();
+    }
+
+    void swap(socow_string& that) {
+        chars_.swap(that.chars_);
+    }
+
+    // The first character of s is located with a vectorized scan, the rest
+    // is compared at each candidate.
+    size_t find(view_type s, size_t pos = 0) const {
+        size_t n = size();
+        size_t m = s.size();
+        if (m == 0) {
+            return pos <= n ? pos : npos;
+        }
+        CharT const* p = c_str();
+        while (pos < n && n - pos >= m) {
+            size_t i = pos + socow_simd::find(p + pos, n - pos - m + 1, s[0]);
+            if (i > n - m) {
+                break;
+            }
+            if (socow_simd::equal(p + i + 1, s.data() + 1, m - 1)) {
+                return i;
+            }
+            pos = i + 1;
+        }
+        return npos;
+    }
+
+    size_t find(CharT c, size_t pos = 0) const {
+        size_t n = size();
+        if (pos >= n) {
+            return npos;
+        }
+        size_t i = pos + socow_simd::find(c_str() + pos, n - pos, c);
+        return i == n ? npos : i;
+    }
+
+    int compare(view_type s) const {
+        size_t n = size();
+        size_t common = std::min(n, s.size());
+        size_t i = socow_simd::mismatch(c_str(), s.data(), common);
+        if (i != common) {
+            return traits_type::lt(c_str()[i], s[i]) ? -1 : 1;
+        }
+        return n < s.size() ? -1 : n > s.size() ? 1 : 0;
+    }
+
+    bool starts_with(view_type s) const {
+        return s.size() <= size() && socow_simd::equal(c_str(), s.data(), s.size());
+    }
+
+    bool ends_with(view_type s) const {
+        return s.size() <= size() && socow_simd::equal(end() - s.size(), s.data(), s.size());
+    }
+
+    friend bool operator==(socow_string const& a, socow_string const& b) {
+        return a.chars_ == b.chars_;
+    }
+
+    friend bool operator!=(socow_string const& a, socow_string const& b) {
+        return !(a == b);
+    }
+
+    friend bool operator<(socow_string const& a, socow_string const& b) {
+        return a.compare(b) < 0;
+    }
+
+    friend bool operator>(socow_string const& a, socow_string const& b) {
+        return b < a;
+    }
+
+    friend bool operator<=(socow_string const& a, socow_string const& b) {
+        return !(b < a);
+    }
+
+    friend bool operator>=(socow_string const& a, socow_string const& b) {
+        return !(a < b);
+    }
+
+private:
+    friend struct std::hash<socow_string>;
+
+    socow_vector<CharT, SMALL_SIZE + 1> chars_;
+};
+
+namespace std {
+template <typename CharT, size_t SMALL_SIZE>
+struct hash<socow_string<CharT, SMALL_SIZE>> {
+    size_t operator()(socow_string<CharT, SMALL_SIZE> const& s) const {
+        return hash<socow_vector<CharT, SMALL_SIZE + 1>>()(s.chars_);
+    }
+};
+} // namespace std
@@ -1,36 +1,676 @@
 #pragma once
 #include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#if defined(SOCOW_PROFILE)
+#include <typeinfo>
+
+#include "socow-profile.h"
+#endif
+
+#if defined(__GNUC__)
+#define SOCOW_NOINLINE __attribute__((noinline))
+#define SOCOW_COLD __attribute__((cold, noinline))
+#elif defined(_MSC_VER)
+#define SOCOW_NOINLINE __declspec(noinline)
+#define SOCOW_COLD __declspec(noinline)
+#else
+#define SOCOW_NOINLINE
+#define SOCOW_COLD
+#endif
+
+// Under C++20 the inline-buffer path can run in constant expressions; the
+// heap path cannot, since blocks are raw memory addressed through offsets.
+#if defined(__cpp_constexpr_dynamic_alloc) && defined(__cpp_lib_constexpr_dynamic_alloc) && \
+    defined(__cpp_lib_is_constant_evaluated)
+#define SOCOW_HAS_CONSTEXPR 1
+#define SOCOW_CONSTEXPR constexpr
+#else
+#define SOCOW_HAS_CONSTEXPR 0
+#define SOCOW_CONSTEXPR
+#endif
+
+namespace socow_detail {
+constexpr bool constant_evaluated() noexcept {
+#if defined(__cpp_lib_is_constant_evaluated)
+    return std::is_constant_evaluated();
+#else
+    return false;
+#endif
+}
+
+// Constant evaluation keeps the whole inline array alive and assigns into
+// it, so only such element types take that path.
+template <typename T>
+constexpr bool constexpr_storable = std::is_default_constructible<T>::value && std::is_copy_assignable<T>::value;
+
+// Names a feature that is only declared here, through a template parameter,
+// so that just the members using it need the header defining it.
+template <typename Feature, typename>
+struct feature {
+    using type = Feature;
+};
+
+// Lanes through which scans compare elements: integers, enums and pointers
+// by their bit pattern, floating point values with IEEE equality.
+template <typename T, typename = void>
+struct lane {
+    using type = void;
+};
+
+template <typename T>
+struct lane<T, std::enable_if_t<(std::is_integral<T>::value || std::is_enum<T>::value ||
+                                 std::is_pointer<T>::value) &&
+                                (sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 ||
+                                 sizeof(T) == 8)>> {
+    using type = std::conditional_t<
+        sizeof(T) == 1, uint8_t,
+        std::conditional_t<sizeof(T) == 2, uint16_t,
+                           std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>>>;
+};
+
+template <>
+struct lane<float> {
+    using type = float;
+};
+
+template <>
+struct lane<double> {
+    using type = double;
+};
+
+template <typename T>
+using lane_t = typename lane<std::remove_cv_t<T>>::type;
+
+template <typename L>
+inline L load(void const* p, size_t i) noexcept {
+    L result;
+    std::memcpy(&result, static_cast<char const*>(p) + i * sizeof(L), sizeof(L));
+    return result;
+}
+
+// Vectorized scans over lanes of type L, installed by socow-simd.h. Until
+// then scans are plain loops.
+template <typename L>
+struct scan_ops {
+    size_t (*find)(void const* p, size_t n, L value) noexcept;
+    size_t (*count)(void const* p, size_t n, L value) noexcept;
+    size_t (*mismatch)(void const* a, void const* b, size_t n) noexcept;
+};
+
+template <typename L>
+inline std::atomic<scan_ops<L> const*> scans{nullptr};
+
+template <typename T>
+size_t find(T const* p, size_t n, T const& value) {
+    if constexpr (!std::is_void<lane_t<T>>::value) {
+        if (scan_ops<lane_t<T>> const* s = scans<lane_t<T>>.load(std::memory_order_relaxed)) {
+            return s->find(p, n, load<lane_t<T>>(&value, 0));
+        }
+    }
+    for (size_t i = 0; i != n; ++i) {
+        if (p[i] == value) {
+            return i;
+        }
+    }
+    return n;
+}
+
+template <typename T>
+size_t count(T const* p, size_t n, T const& value) {
+    if constexpr (!std::is_void<lane_t<T>>::value) {
+        if (scan_ops<lane_t<T>> const* s = scans<lane_t<T>>.load(std::memory_order_relaxed)) {
+            return s->count(p, n, load<lane_t<T>>(&value, 0));
+        }
+    }
+    size_t result = 0;
+    for (size_t i = 0; i != n; ++i) {
+        result += p[i] == value;
+    }
+    return result;
+}
+
+// Index of the first position where a[i] == b[i] does not hold.
+template <typename T>
+size_t mismatch(T const* a, T const* b, size_t n) {
+    if constexpr (!std::is_void<lane_t<T>>::value) {
+        if (scan_ops<lane_t<T>> const* s = scans<lane_t<T>>.load(std::memory_order_relaxed)) {
+            return s->mismatch(a, b, n);
+        }
+    }
+    for (size_t i = 0; i != n; ++i) {
+        if (!(a[i] == b[i])) {
+            return i;
+        }
+    }
+    return n;
+}
+
+template <typename T>
+bool equal(T const* a, T const* b, size_t n) {
+    if constexpr (std::is_integral<lane_t<T>>::value) {
+        return n == 0 || std::memcmp(a, b, n * sizeof(T)) == 0;
+    } else {
+        return mismatch(a, b, n) == n;
+    }
+}
+
+template <typename T>
+bool lexicographical_less(T const* a, size_t n, T const* b, size_t m) {
+    size_t common = n < m ? n : m;
+    if constexpr (std::is_integral<T>::value || std::is_pointer<T>::value) {
+        size_t i = mismatch(a, b, common);
+        return i == common ? n < m : a[i] < b[i];
+    } else {
+        for (size_t i = 0; i != common; ++i) {
+            if (a[i] < b[i]) {
+                return true;
+            }
+            if (b[i] < a[i]) {
+                return false;
+            }
+        }
+        return n < m;
+    }
+}
+
+// xxh64 with seed 0: four independent 64-bit lanes per 32-byte stripe.
+inline uint64_t rotl(uint64_t x, int r) noexcept {
+    return (x << r) | (x >> (64 - r));
+}
+
+constexpr uint64_t prime1 = 0x9e3779b185ebca87ULL;
+constexpr uint64_t prime2 = 0xc2b2ae3d27d4eb4fULL;
+constexpr uint64_t prime3 = 0x165667b19e3779f9ULL;
+constexpr uint64_t prime4 = 0x85ebca77c2b2ae63ULL;
+constexpr uint64_t prime5 = 0x27d4eb2f165667c5ULL;
+
+inline uint64_t hash_round(uint64_t acc, uint64_t input) noexcept {
+    return rotl(acc + input * prime2, 31) * prime1;
+}
+
+inline uint64_t hash_merge(uint64_t acc, uint64_t lane) noexcept {
+    return (acc ^ hash_round(0, lane)) * prime1 + prime4;
+}
+
+inline uint64_t hash_bytes(void const* data, size_t len) noexcept {
+    char const* p = static_cast<char const*>(data);
+    char const* end = p + len;
+    uint64_t h;
+    if (len >= 32) {
+        uint64_t v1 = prime1 + prime2;
+        uint64_t v2 = prime2;
+        uint64_t v3 = 0;
+        uint64_t v4 = 0 - prime1;
+        for (; end - p >= 32; p += 32) {
+            v1 = hash_round(v1, load<uint64_t>(p, 0));
+            v2 = hash_round(v2, load<uint64_t>(p, 1));
+            v3 = hash_round(v3, load<uint64_t>(p, 2));
+            v4 = hash_round(v4, load<uint64_t>(p, 3));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = hash_merge(h, v1);
+        h = hash_merge(h, v2);
+        h = hash_merge(h, v3);
+        h = hash_merge(h, v4);
+    } else {
+        h = prime5;
+    }
+    h += len;
+    for (; end - p >= 8; p += 8) {
+        h = rotl(h ^ hash_round(0, load<uint64_t>(p, 0)), 27) * prime1 + prime4;
+    }
+    if (end - p >= 4) {
+        h = rotl(h ^ (load<uint32_t>(p, 0) * prime1), 23) * prime2 + prime3;
+        p += 4;
+    }
+    for (; p != end; ++p) {
+        h = rotl(h ^ (static_cast<unsigned char>(*p) * prime5), 11) * prime1;
+    }
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+template <typename T>
+size_t hash(T const* p, size_t n) {
+    if constexpr (std::has_unique_object_representations<T>::value) {
+        return static_cast<size_t>(hash_bytes(p, n * sizeof(T)));
+    } else {
+        uint64_t h = prime5 + n;
+        for (size_t i = 0; i != n; ++i) {
+            h = hash_round(h, std::hash<T>()(p[i]));
+        }
+        h ^= h >> 33;
+        h *= prime2;
+        h ^= h >> 29;
+        return static_cast<size_t>(h);
+    }
+}
+
+// Installed by socow_parallel while parallel copies are enabled; returns
+// false for ranges too small to split.
+inline std::atomic<bool (*)(void* dst, void const* src, size_t n)> parallel_copy{nullptr};
+
+// Installed by socow-simd.h, which streams large copies past the cache.
+inline std::atomic<void (*)(void* dst, void const* src, size_t n) noexcept> stream_copy{nullptr};
+
+inline void copy_bytes(void* dst, void const* src, size_t n) noexcept {
+    if (auto copy = stream_copy.load(std::memory_order_relaxed)) {
+        copy(dst, src, n);
+    } else if (n != 0) {
+        std::memcpy(dst, src, n);
+    }
+}
+
+struct block_header;
+struct codec_ops;
+
+// Hooks of blocks whose elements do not live in operator new memory right
+// after the header. release() frees the block once its last reference is
+// dropped; grow() may extend a uniquely owned block in place and returns
+// false when the block has to be copied instead. movable_front is set for
+// blocks whose elements follow the header in memory they own, so the first
+// element may move, and codec for blocks holding an encoding of their
+// elements instead of the elements.
+struct block_ops {
+    void (*release)(block_header*) noexcept;
+    bool (*grow)(block_header*, size_t new_capacity);
+    bool movable_front = false;
+    codec_ops const* codec = nullptr;
+};
+
+// Hooks of a block encoding its elements in frames of frame_size that
+// decode independently, such as socow-packed.h makes. decode_frame writes
+// frame f and returns its length; may_contain rules out frames that cannot
+// hold the value.
+struct codec_ops {
+    static constexpr size_t frame_size = 128;
+
+    size_t (*decode_frame)(block_header const*, size_t f, void* out) noexcept;
+    bool (*may_contain)(block_header const*, size_t f, void const* value) noexcept;
+};
+
+// Installed by socow_block_pool while it is enabled, and by socow-mmap.h
+// for zero-filled blocks. Both return null for blocks they do not serve;
+// otherwise ops is set to the hooks that free the block.
+using allocate_hook = void* (*)(size_t bytes, size_t alignment, block_ops const*& ops);
+
+inline std::atomic<allocate_hook> pool_allocate{nullptr};
+inline std::atomic<allocate_hook> zeroed_allocate{nullptr};
+
+// A copy of a shared block started ahead of a write by socow-async.h: the
+// source block, still retained, and the copy, null if copying failed.
+struct pending_copy {
+    block_header* source;
+    block_header* copy;
+};
+
+// Installed by socow-async.h before a copy starts: removes the entry of the
+// given vector, waits for its copy and hands both blocks over.
+inline std::atomic<pending_copy (*)(void const* vector) noexcept> take_pending{nullptr};
+
+// Everything in a block but the elements. None of it depends on the element
+// type, so reference counting, allocation and freeing are compiled once.
+struct block_header {
+    static constexpr size_t frozen = static_cast<size_t>(-1);
+
+    size_t ref_counter;
+    size_t capacity_;
+    size_t hash_;
+    bool hashed_;
+    uintptr_t data_offset_;
+    block_ops const* ops_;
+};
+
+// Elements are found through an offset relative to the header, so a block
+// stays valid wherever its memory is mapped.
+template <typename T>
+struct content : block_header {
+    T data_[];
+
+    static content* place(void* memory, size_t ref_counter, size_t capacity) noexcept {
+        content* c = static_cast<content*>(memory);
+        new(&c->ref_counter) size_t(ref_counter);
+        new(&c->capacity_) size_t(capacity);
+        new(&c->hashed_) bool(false);
+        new(&c->ops_) block_ops const*(nullptr);
+        c->set_data(c->data_);
+        return c;
+    }
+
+    T* data() noexcept {
+        return reinterpret_cast<T*>(reinterpret_cast<uintptr_t>(this) + data_offset_);
+    }
+
+    void set_data(T* p) noexcept {
+        data_offset_ = reinterpret_cast<uintptr_t>(p) - reinterpret_cast<uintptr_t>(this);
+    }
+};
+
+// Size of a block with the given header and capacity; throws rather than
+// wrap around.
+inline size_t block_bytes(size_t header, size_t element_size, size_t capacity) {
+    if (capacity > (SIZE_MAX - header) / element_size) {
+        throw std::length_error("socow_vector: capacity too large");
+    }
+    return header + element_size * capacity;
+}
+
+// Types whose value-initialized value is all zero bytes.
+template <typename T>
+struct zero_is_value
+    : std::integral_constant<bool, std::is_arithmetic<T>::value || std::is_enum<T>::value || std::is_pointer<T>::value> {};
+
+// Zero-filled memory for a block, from calloc unless socow-mmap.h takes
+// large blocks from fresh anonymous mappings.
+struct zeroed_block {
+    static void* allocate(size_t bytes, size_t alignment, block_ops const*& ops) {
+        if (allocate_hook map = zeroed_allocate.load(std::memory_order_relaxed)) {
+            if (void* memory = map(bytes, alignment, ops)) {
+                return memory;
+            }
+        }
+        if (alignment > alignof(std::max_align_t)) {
+            ops = nullptr;
+            void* memory = operator new(bytes, static_cast<std::align_val_t>(alignment));
+            return std::memset(memory, 0, bytes);
+        }
+        void* memory = std::calloc(1, bytes);
+        if (memory == nullptr) {
+            throw std::bad_alloc();
+        }
+        ops = &calloc_ops;
+        return memory;
+    }
+
+    static bool grow(block_header*, size_t) {
+        return false;
+    }
+
+    static void release_calloc(block_header* c) noexcept {
+        std::free(c);
+    }
+
+    static constexpr block_ops calloc_ops = {&release_calloc, &grow};
+};
+
+// Returns memory for a block and sets ops to the hooks that free it, which
+// are null for plain operator new memory.
+SOCOW_NOINLINE inline void* allocate_block(size_t bytes, size_t alignment, block_ops const*& ops) {
+    if (allocate_hook pool = pool_allocate.load(std::memory_order_relaxed)) {
+        if (void* memory = pool(bytes, alignment, ops)) {
+            return memory;
+        }
+    }
+    ops = nullptr;
+    return operator new(bytes, static_cast<std::align_val_t>(alignment));
+}
+
+SOCOW_NOINLINE inline void free_block(block_header* c, size_t alignment) noexcept {
+    if (c->ops_ != nullptr) {
+        c->ops_->release(c);
+    } else {
+        operator delete(c, static_cast<std::align_val_t>(alignment));
+    }
+}
+
+inline void retain(block_header* c) noexcept {
+    if (c->ref_counter != block_header::frozen) {
+        c->ref_counter++;
+    }
+}
+
+SOCOW_NOINLINE inline void drop(block_header* c, size_t alignment) noexcept {
+    if (c->ref_counter == block_header::frozen) {
+        return;
+    }
+    if (c->ref_counter == 1) {
+        free_block(c, alignment);
+    } else {
+        c->ref_counter--;
+    }
+}
+
+// A block encoding capacity_ elements through the codec of its ops. The
+// encoding follows a slot for a decoded copy, which const readers build on
+// first use and share until the block goes; releasing the block drops it.
+template <typename T>
+struct encoded_block {
+    using slot = std::atomic<content<T>*>;
+
+    static slot& decoded(content<T>* c) noexcept {
+        return *std::launder(reinterpret_cast<slot*>(c->data_));
+    }
+
+    static char* encoding(content<T>* c) noexcept {
+        return reinterpret_cast<char*>(c->data_) + sizeof(slot);
+    }
+
+    static char const* encoding(content<T> const* c) noexcept {
+        return reinterpret_cast<char const*>(c->data_) + sizeof(slot);
+    }
+
+    static size_t frames(content<T> const* c) noexcept {
+        return (c->capacity_ + codec_ops::frame_size - 1) / codec_ops::frame_size;
+    }
+
+    static void decode(content<T> const* c, T* out) noexcept {
+        for (size_t f = 0; f != frames(c); ++f) {
+            c->ops_->codec->decode_frame(c, f, out + f * codec_ops::frame_size);
+        }
+    }
+};
+
+// Made by socow-packed.h.
+template <typename T>
+struct packed_block;
+
+template <typename T>
+struct storage {
+    using content = socow_detail::content<T>;
+
+    content* content_ptr;
+
+    storage() : content_ptr(nullptr){}
+
+    explicit storage(size_t capacity) : content_ptr(allocate(capacity)) {}
+
+    explicit storage(content* adopted) noexcept : content_ptr(adopted) {}
+
+    storage(storage const& other) : content_ptr(other.content_ptr) {
+        retain(content_ptr);
+    }
+
+    storage& operator=(storage const& other) {
+        if (&other != this) {
+            storage tmp(other);
+            std::swap(tmp.content_ptr, this->content_ptr);
+        }
+        return *this;
+    }
+
+    ~storage() {
+        drop(content_ptr, alignof(content));
+    }
+
+    static content* allocate(size_t capacity) {
+        block_ops const* ops;
+        void* memory = allocate_block(block_bytes(sizeof(content), sizeof(T), capacity), alignof(content), ops);
+        content* c = content::place(memory, 1, capacity);
+        c->ops_ = ops;
+        return c;
+    }
+
+    static content* allocate_zeroed(size_t capacity) {
+        block_ops const* ops;
+        void* memory = zeroed_block::allocate(block_bytes(sizeof(content), sizeof(T), capacity), alignof(content), ops);
+        content* c = content::place(memory, 1, capacity);
+        c->ops_ = ops;
+        return c;
+    }
+
+    T* get() {
+        return content_ptr->data();
+    }
+    T* get() const {
+        return content_ptr->data();
+    }
+    bool unique() {
+        return content_ptr->ref_counter == 1;
+    }
+    bool grow(size_t new_capacity) {
+        return content_ptr->ops_ != nullptr && content_ptr->ops_->grow(content_ptr, new_capacity);
+    }
+    void invalidate_hash() noexcept {
+        content_ptr->hashed_ = false;
+    }
+};
+
+// A block whose elements belong to an external buffer kept alive by Holder,
+// which is stored in the header allocation right after the counters.
+template <typename T, typename Holder>
+struct holder_block {
+    using content = socow_detail::content<T>;
+
+    static_assert(std::is_trivially_destructible<T>::value,
+                  "adopted buffers must hold trivially destructible elements");
+    static_assert(alignof(Holder) <= alignof(content), "holder is over-aligned");
+
+    static content* make(Holder&& holder, T* data, size_t capacity) {
+        content* c = content::place(operator new(sizeof(content) + sizeof(Holder), static_cast<std::align_val_t>(alignof(content))), 1, capacity);
+        new(c->data_) Holder(std::move(holder));
+        c->set_data(data);
+        c->ops_ = &ops;
+        return c;
+    }
+
+    static Holder& of(content* c) noexcept {
+        return *reinterpret_cast<Holder*>(c->data_);
+    }
+
+    static void release(block_header* c) noexcept {
+        of(static_cast<content*>(c)).~Holder();
+        operator delete(c, static_cast<std::align_val_t>(alignof(content)));
+    }
+
+    static bool grow(block_header*, size_t) {
+        return false;
+    }
+
+    static constexpr block_ops ops = {&release, &grow};
+};
+
+// Owns the elements of a block handed out by socow_vector::release().
+template <typename T>
+struct buffer_deleter {
+    content<T>* block = nullptr;
+    size_t size = 0;
+
+    void operator()(T* p) const noexcept {
+        for (size_t i = size; i != 0; --i) {
+            p[i - 1].~T();
+        }
+        storage<T> last(block);
+    }
+};
+} // namespace socow_detail
+
+// Defined in socow-async.h.
+struct socow_async;
 
 template <typename T, size_t SMALL_SIZE>
 struct socow_vector {
     using iterator = T*;
     using const_iterator = T const*;
+    using buffer = std::unique_ptr<T[], socow_detail::buffer_deleter<T>>;
+
+    SOCOW_CONSTEXPR socow_vector() noexcept
+        : size_(0), small(true) {
+#if SOCOW_HAS_CONSTEXPR
+        if constexpr (socow_detail::constexpr_storable<T>) {
+            if (socow_detail::constant_evaluated()) {
+                std::construct_at(&static_storage);
+            }
+        }
+#endif
+        profile_start();
+    }
+
+    explicit socow_vector(std::vector<T>&& that) : socow_vector() {
+        size_t n = that.size();
+        if (n <= SMALL_SIZE) {
+            copy(that.data(), that.data() + n, static_storage.begin());
+        } else {
+            T* p = that.data();
+            new(&dynamic_storage) storage(socow_detail::holder_block<T, std::vector<T>>::make(std::move(that), p, n));
+            small = false;
+        }
+        size_ = n;
+    }
 
-    socow_vector() noexcept
-        : size_(0), small(true) {}
+    template <typename D>
+    socow_vector(std::unique_ptr<T[], D>&& that, size_t size) : socow_vector() {
+        if (size <= SMALL_SIZE) {
+            copy(that.get(), that.get() + size, static_storage.begin());
+            that.reset();
+        } else {
+            T* p = that.get();
+            new(&dynamic_storage) storage(socow_detail::holder_block<T, std::unique_ptr<T[], D>>::make(std::move(that), p, size));
+            small = false;
+        }
+        size_ = size;
+    }
 
-    socow_vector(socow_vector const& that) : socow_vector() {
+    SOCOW_CONSTEXPR socow_vector(socow_vector const& that) : socow_vector() {
         if (that.small) {
-            copy(that.static_storage.begin(), that.static_storage.end(), static_storage.begin());
+            copy(that.static_storage.begin(), that.static_storage.begin() + that.size_, static_storage.begin());
+        } else if (copy_eagerly(that)) {
+            new(&dynamic_storage) storage(copy_of(that));
         } else {
+            if (that.migrating_) {
+                that.migrated_view();
+            }
             new(&dynamic_storage) storage(that.dynamic_storage);
         }
         size_ = that.size_;
         small = that.small;
+        compressed_ = that.compressed_;
     }
 
-    socow_vector& operator=(socow_vector const& other) {
+    SOCOW_CONSTEXPR socow_vector& operator=(socow_vector const& other) {
         if (this == &other) {
             return *this;
         }
         socow_vector tmp = socow_vector(other);
+        if (migrating_) {
+            drop_migration();
+        }
         tmp.swap(*this);
         return *this;
     }
 
-    ~socow_vector() {
-        if (small || dynamic_storage.unique()) {
+    SOCOW_CONSTEXPR ~socow_vector() {
+        profile_end();
+        if (migrating_) {
+            drop_migration();
+        }
+        settle();
+        if (!compressed_ && (small || dynamic_storage.unique())) {
             destruct_range(my_begin(), my_end());
         }
         if (!small) {
@@ -39,106 +679,295 @@ struct socow_vector {
         size_ = 0;
     }
 
-    T& operator[](size_t i) {
-        update_before_changes();
-        return *(my_begin() + i);
+    SOCOW_CONSTEXPR T& operator[](size_t i) {
+        return element_for_write(i);
     }
 
-    T const& operator[](size_t i) const noexcept {
-        return *(begin() + i);
+    SOCOW_CONSTEXPR T const& operator[](size_t i) const noexcept(nothrow_reads) {
+        return element(i);
     }
 
-    T* data() {
+    SOCOW_CONSTEXPR T* data() {
         update_before_changes();
         return (small ? static_storage.begin() : dynamic_storage.get());
     }
 
-    T const* data() const noexcept {
-        return (small ? static_storage.begin() : dynamic_storage.get());
+    SOCOW_CONSTEXPR T const* data() const noexcept(nothrow_reads) {
+        return read_begin();
     }
 
-    size_t size() const noexcept {
+    SOCOW_CONSTEXPR size_t size() const noexcept {
         return size_;
     }
 
-    T& front() {
-        update_before_changes();
-        return *my_begin();
+    SOCOW_CONSTEXPR T& front() {
+        return element_for_write(0);
     }
 
-    T const& front() const noexcept {
-        return *begin();
+    SOCOW_CONSTEXPR T const& front() const noexcept(nothrow_reads) {
+        return element(0);
     }
 
-    T& back() {
-        update_before_changes();
-        return *(my_end() - 1);
+    SOCOW_CONSTEXPR T& back() {
+        return element_for_write(size_ - 1);
     }
-    T const& back() const noexcept {
-        return *(end() - 1);
+    SOCOW_CONSTEXPR T const& back() const noexcept(nothrow_reads) {
+        return element(size_ - 1);
     }
-    void push_back(T const& e) {
+    SOCOW_CONSTEXPR void push_back(T const& e) {
+        if (migration_open()) {
+            if (size_ < dynamic_storage.content_ptr->capacity_) {
+                new (my_end()) T(e);
+                ++size_;
+                advance_migration(migration_step());
+                return;
+            }
+            finish_migration();
+        }
+        settle();
+        if (compressed_) {
+            unpack();
+        }
         if (small && size_ + 1 <= SMALL_SIZE) {
-            new (my_end()) T(e);
+            construct(my_end(), e);
         } else {
             if (small) {
                 T tmp = e;
                 create_storage(SMALL_SIZE * 2);
                 new(my_end()) T(tmp);
             } else {
-                if (dynamic_storage.content_ptr->capacity_ == size_ || !dynamic_storage.unique()) {
+                if (dynamic_storage.content_ptr->capacity_ == size_ && dynamic_storage.unique() &&
+                    dynamic_storage.content_ptr->ops_ != nullptr) {
+                    T tmp = e;
+                    if (!dynamic_storage.grow(size_ * 2) && !start_migration(size_ * 2)) {
+                        new(&dynamic_storage) storage(realloc(size_ * 2, my_begin(), my_end()));
+                    }
+                    new (my_end()) T(tmp);
+                    dynamic_storage.invalidate_hash();
+                } else if (dynamic_storage.content_ptr->capacity_ == size_ || !dynamic_storage.unique()) {
+                    if (!dynamic_storage.unique()) {
+                        note_detach();
+                    }
                     T tmp = e;
-                    new(&dynamic_storage) storage(realloc((dynamic_storage.content_ptr->capacity_ * (dynamic_storage.content_ptr->capacity_ == size_ ? 2 : 1)), my_begin(), my_end()));
+                    size_t new_capacity = dynamic_storage.content_ptr->capacity_ * (dynamic_storage.content_ptr->capacity_ == size_ ? 2 : 1);
+                    if (!start_migration(new_capacity)) {
+                        new(&dynamic_storage) storage(realloc(new_capacity, my_begin(), my_end()));
+                    }
                     new (my_end()) T(tmp);
                 } else {
                     new (my_end()) T(e);
+                    dynamic_storage.invalidate_hash();
                 }
             }
         }
         ++size_;
+        profile_size();
+        if (migrating_) {
+            advance_migration(migration_step());
+        }
     }
     void pop_back() {
+        if (pending_) {
+            finish_pending();
+        }
+        if (migration_open() || detach_incrementally()) {
+            pop_back_migrating();
+            return;
+        }
         update_before_changes();
         size_--;
         my_end()->~T();
     }
 
-    bool empty() const noexcept {
+    // Heap blocks keep spare room in front of the first element, so
+    // push_front and pop_front are amortized O(1) and insert and erase
+    // shift whichever side of the position is shorter.
+    void push_front(T const& e) {
+        emplace_front(e);
+    }
+
+    template <typename... Args>
+    void emplace_front(Args&&... args) {
+        settle();
+        if (compressed_) {
+            unpack();
+        }
+        if (small && size_ < SMALL_SIZE) {
+            new (my_end()) T(std::forward<Args>(args)...);
+            ++size_;
+            for (size_t i = size_ - 1; i != 0; i--) {
+                std::swap(static_storage[i], static_storage[i - 1]);
+            }
+            profile_size();
+            return;
+        }
+        if (front_adjustable() && front_slack() != 0) {
+            T* p = dynamic_storage.get() - 1;
+            new (p) T(std::forward<Args>(args)...);
+            move_front(p);
+            ++size_;
+            profile_size();
+            return;
+        }
+        T tmp(std::forward<Args>(args)...);
+        if (!small && !dynamic_storage.unique()) {
+            note_detach();
+        }
+        size_t spare = std::max(size_ + 1, SMALL_SIZE);
+        size_t front = (spare + 1) / 2;
+        content* c = storage::allocate(front + size_ + 1 + (spare - front));
+        T* p = c->data() + front;
+        bool constructed = false;
+        try {
+            new (p) T(tmp);
+            constructed = true;
+            copy(my_begin(), my_end(), p + 1);
+        } catch (...) {
+            if (constructed) {
+                p->~T();
+            }
+            storage discard(c);
+            throw;
+        }
+        c->set_data(p);
+        c->capacity_ -= front;
+        if (small) {
+            destruct_range(my_begin(), my_end());
+            small = false;
+            profile_move(true);
+        } else {
+            if (dynamic_storage.unique()) {
+                destruct_range(my_begin(), my_end());
+            }
+            dynamic_storage.~storage();
+        }
+        new (&dynamic_storage) storage(c);
+        ++size_;
+        profile_size();
+    }
+
+    void pop_front() {
+        update_before_changes();
+        if (front_adjustable()) {
+            T* p = dynamic_storage.get();
+            p->~T();
+            move_front(p + 1);
+            --size_;
+            return;
+        }
+        T* p = my_begin();
+        for (size_t i = 1; i < size_; i++) {
+            std::swap(p[i - 1], p[i]);
+        }
+        pop_back();
+    }
+
+    SOCOW_CONSTEXPR bool empty() const noexcept {
         return size_ == 0;
     }
 
-    size_t capacity() const noexcept {
+    SOCOW_CONSTEXPR size_t capacity() const noexcept {
         return (small ? SMALL_SIZE : dynamic_storage.content_ptr->capacity_);
     }
 
     void reserve(size_t new_cap) {
+        settle();
+        if (compressed_) {
+            unpack();
+        }
         if (small && new_cap > SMALL_SIZE) {
             create_storage(new_cap);
         } else if (!small && new_cap >= size_ && !dynamic_storage.unique()) {
+            note_detach();
             new(&dynamic_storage) storage(realloc(new_cap, my_begin(), my_end()));
         }
     }
 
     void shrink_to_fit() {
+        settle();
+        if (compressed_) {
+            unpack();
+        }
         if (!small) {
             if (size_ <= SMALL_SIZE) {
                 big_to_small();
-            } else if (size_ != dynamic_storage.content_ptr->capacity_) {
+            } else if (size_ != dynamic_storage.content_ptr->capacity_ || (front_adjustable() && front_slack() != 0)) {
                 new(&dynamic_storage) storage(realloc(size_, my_begin(), my_end()));
             }
         }
     }
 
+    // Growing value-initializes the new elements. For arithmetic, enum and
+    // pointer types a new block comes zero-filled from calloc or, when
+    // large, from fresh zero pages, and the new elements are not written.
+    void resize(size_t n) {
+        if (n <= size_) {
+            truncate(n);
+            return;
+        }
+        bool zeroed = make_room(n, true);
+        T* p = my_begin();
+        if (zeroed) {
+            size_ = n;
+        }
+        for (; size_ != n; ++size_) {
+            new (p + size_) T();
+        }
+        profile_size();
+    }
+
+    void resize(size_t n, T const& value) {
+        if (n <= size_) {
+            truncate(n);
+            return;
+        }
+        T tmp = value;
+        make_room(n, false);
+        T* p = my_begin();
+        for (; size_ != n; ++size_) {
+            new (p + size_) T(tmp);
+        }
+        profile_size();
+    }
+
+    // Like resize(n), but the new elements are default-initialized, which
+    // leaves trivial ones unwritten.
+    void resize_default_init(size_t n) {
+        if (n <= size_) {
+            truncate(n);
+            return;
+        }
+        make_room(n, false);
+        T* p = my_begin();
+        for (; size_ != n; ++size_) {
+            new (p + size_) T;
+        }
+        profile_size();
+    }
+
     void clear() noexcept {
+        settle();
+        if (compressed_) {
+            dynamic_storage.~storage();
+            compressed_ = false;
+            small = true;
+            size_ = 0;
+            return;
+        }
         if (!small && !dynamic_storage.unique()) {
             dynamic_storage = storage(capacity());
         } else {
             destruct_range(my_begin(), my_end());
+            if (!small) {
+                dynamic_storage.invalidate_hash();
+            }
         }
         size_ = 0;
     }
 
-    void swap(socow_vector& that) {
+    SOCOW_CONSTEXPR void swap(socow_vector& that) {
+        settle();
+        that.settle();
         if (small && that.small) {
             for (size_t i = 0; i < std::min(size_, that.size_); i++) {
                 std::swap(static_storage[i], that.static_storage[i]);
@@ -160,33 +989,45 @@ struct socow_vector {
         }
         std::swap(that.size_, size_);
         std::swap(small, that.small);
+        std::swap(compressed_, that.compressed_);
+        profile_size();
+        that.profile_size();
     }
-    iterator my_begin() {
+    SOCOW_CONSTEXPR iterator my_begin() {
         return (small ? static_storage.begin() : dynamic_storage.get());
     }
-    iterator my_end() {
+    SOCOW_CONSTEXPR iterator my_end() {
         return my_begin() + size_;
     }
-    iterator begin() {
+    SOCOW_CONSTEXPR iterator begin() {
         update_before_changes();
         return (small ? static_storage.begin() : dynamic_storage.get());
     }
 
-    iterator end() {
+    SOCOW_CONSTEXPR iterator end() {
         return begin() + size_;
     }
 
-    const_iterator begin() const noexcept {
-        return (small ? static_storage.begin() : dynamic_storage.get());
+    SOCOW_CONSTEXPR const_iterator begin() const noexcept(nothrow_reads) {
+        return read_begin();
     }
 
-    const_iterator end() const noexcept {
+    SOCOW_CONSTEXPR const_iterator end() const noexcept(nothrow_reads) {
         return begin() + size_;
     }
 
     iterator insert(const_iterator pos, T const& e) {
         size_t index = pos - my_begin();
+        if (!small && index < size_ / 2) {
+            emplace_front(e);
+            T* p = my_begin();
+            for (size_t i = 0; i != index; i++) {
+                std::swap(p[i], p[i + 1]);
+            }
+            return p + index;
+        }
         push_back(e);
+        settle();
         for (size_t i = size_ - 1; i > index; i--) {
             std::swap(*(my_begin() + i), *(my_begin() + i - 1));
         }
@@ -201,6 +1042,16 @@ struct socow_vector {
         size_t start = first - my_begin();
         size_t ending = last - my_begin();
         update_before_changes();
+        if (start < size_ - ending && front_adjustable()) {
+            T* p = my_begin();
+            for (size_t i = start; i != 0; i--) {
+                std::swap(p[i - 1], p[i - 1 + (ending - start)]);
+            }
+            for (size_t i = 0; i < ending - start; i++) {
+                pop_front();
+            }
+            return my_begin() + start;
+        }
         for (T* it = my_begin() + ending; it < my_end(); it++) {
             std::swap(*it, *(it - (ending - start)));
         }
@@ -210,65 +1061,697 @@ struct socow_vector {
         return my_begin() + start;
     }
 
+    // Starts copying a shared heap block on executor, which is called with a
+    // std::function<void()>. The next mutation installs the copy, waiting
+    // for it if needed, or discards it if the block has become unique in the
+    // meantime. Destroying the vector also waits for the copy. Only trivially
+    // copyable elements are copied in the background; for other types the
+    // returned future is ready and the next mutation detaches as usual.
+    // Needs socow-async.h.
+    template <typename Executor>
+    auto detach_async(Executor&& executor) {
+        return socow_detail::feature<socow_async, Executor>::type::detach(*this, std::forward<Executor>(executor));
+    }
+
+    // Same as detach_async on the socow_parallel pool.
+    auto prepare_write() {
+        return socow_detail::feature<socow_async, T>::type::prepare_write(*this);
+    }
+
+    // With a non-zero step, growth and detach of vectors larger than step
+    // allocate the new block but copy elements into it at most step at a
+    // time, on each following push_back, pop_back and element write. Reads
+    // resolve against both blocks meanwhile; anything that exposes the
+    // elements as a contiguous range completes the migration first. Only
+    // applies to nothrow copy constructible T.
+    static void set_migration_step(size_t step) noexcept {
+        migration_step_.store(step, std::memory_order_relaxed);
+    }
+
+    static size_t migration_step() noexcept {
+        return migration_step_.load(std::memory_order_relaxed);
+    }
+
+    bool migrating() const noexcept {
+        return migrating_;
+    }
+
+    // Copies of heap vectors holding at most bytes bytes of elements copy
+    // them instead of sharing the block; 0, the default, always shares.
+    // With adaptive set such copies keep sharing until at least three
+    // quarters of the recent shared copies turned out to be written to.
+    static void set_eager_copy(size_t bytes, bool adaptive = false) noexcept {
+        eager_copy_bytes_.store(bytes, std::memory_order_relaxed);
+        eager_copy_adaptive_.store(adaptive, std::memory_order_relaxed);
+        shared_copies_.store(0, std::memory_order_relaxed);
+        written_copies_.store(0, std::memory_order_relaxed);
+        eager_copies_.store(0, std::memory_order_relaxed);
+    }
+
+    static size_t eager_copy_bytes() noexcept {
+        return eager_copy_bytes_.load(std::memory_order_relaxed);
+    }
+
+    void finish_migration() noexcept {
+        if (migrating_) {
+            advance_migration(static_cast<size_t>(-1));
+        }
+    }
+
+    const_iterator find(T const& e) const {
+        if constexpr (std::is_unsigned<T>::value) {
+            if (compressed_) {
+                return begin() + find_packed(e);
+            }
+        }
+        return begin() + socow_detail::find(begin(), size_, e);
+    }
+
+    size_t count(T const& e) const {
+        if constexpr (std::is_unsigned<T>::value) {
+            if (compressed_) {
+                return count_packed(e);
+            }
+        }
+        return socow_detail::count(begin(), size_, e);
+    }
+
+    bool contains(T const& e) const {
+        if constexpr (std::is_unsigned<T>::value) {
+            if (compressed_) {
+                return find_packed(e) != size_;
+            }
+        }
+        return find(e) != end();
+    }
+
+    // Replaces the heap block of an unsigned integer vector with its
+    // socow_packed encoding unless that saves no space. Copies share the
+    // packed block, and mutation unpacks it. Const element access, data()
+    // and iterators read a decoded copy that the packed block builds once
+    // and shares among readers, so for such T they may allocate and are not
+    // noexcept. for_each, count, contains and find decode only the frames
+    // they need. Needs socow-packed.h.
+    template <typename U = T>
+    std::enable_if_t<std::is_unsigned<U>::value> compress() {
+        settle();
+        if (small || compressed_ || size_ == 0) {
+            return;
+        }
+        content* c = socow_detail::packed_block<U>::make(dynamic_storage.get(), size_);
+        if (c == nullptr) {
+            return;
+        }
+        dynamic_storage.~storage();
+        new(&dynamic_storage) storage(c);
+        compressed_ = true;
+    }
+
+    bool compressed() const noexcept {
+        return compressed_;
+    }
+
+    template <typename F>
+    void for_each(F&& f) const {
+        if constexpr (std::is_unsigned<T>::value) {
+            if (compressed_) {
+                content* c = dynamic_storage.content_ptr;
+                T frame[socow_detail::codec_ops::frame_size];
+                for (size_t k = 0; k != encoded::frames(c); ++k) {
+                    size_t n = c->ops_->codec->decode_frame(c, k, frame);
+                    for (size_t i = 0; i != n; ++i) {
+                        f(frame[i]);
+                    }
+                }
+                return;
+            }
+        }
+        for (T const& e : *this) {
+            f(e);
+        }
+    }
+
+    buffer release() {
+        settle();
+        if (compressed_) {
+            unpack();
+        }
+        if (small) {
+            create_storage(size_ == 0 ? 1 : size_);
+        } else {
+            update_before_changes();
+        }
+        buffer result(dynamic_storage.get(), socow_detail::buffer_deleter<T>{dynamic_storage.content_ptr, size_});
+        size_ = 0;
+        small = true;
+        return result;
+    }
+
+    std::vector<T> into_vector() {
+        settle();
+        if (compressed_) {
+            unpack();
+        }
+        using vector_block = socow_detail::holder_block<T, std::vector<T>>;
+        std::vector<T> result;
+        if (!small && dynamic_storage.unique() && dynamic_storage.content_ptr->ops_ == &vector_block::ops) {
+            result = std::move(vector_block::of(dynamic_storage.content_ptr));
+            result.resize(size_);
+            dynamic_storage.~storage();
+            size_ = 0;
+            small = true;
+            return result;
+        }
+        result.reserve(size_);
+        if (small || dynamic_storage.unique()) {
+            result.insert(result.end(), std::make_move_iterator(my_begin()), std::make_move_iterator(my_end()));
+        } else {
+            socow_vector const& self = *this;
+            result.insert(result.end(), self.begin(), self.end());
+        }
+        *this = socow_vector();
+        return result;
+    }
+
+    friend bool operator==(socow_vector const& a, socow_vector const& b) {
+        if (a.size_ != b.size_) {
+            return false;
+        }
+        if (!a.small && !b.small && a.dynamic_storage.content_ptr == b.dynamic_storage.content_ptr) {
+            return true;
+        }
+        return socow_detail::equal(a.begin(), b.begin(), a.size_);
+    }
+
+    friend bool operator!=(socow_vector const& a, socow_vector const& b) {
+        return !(a == b);
+    }
+
+    friend bool operator<(socow_vector const& a, socow_vector const& b) {
+        return socow_detail::lexicographical_less(a.begin(), a.size_, b.begin(), b.size_);
+    }
+
+    friend bool operator>(socow_vector const& a, socow_vector const& b) {
+        return b < a;
+    }
+
+    friend bool operator<=(socow_vector const& a, socow_vector const& b) {
+        return !(b < a);
+    }
+
+    friend bool operator>=(socow_vector const& a, socow_vector const& b) {
+        return !(a < b);
+    }
+
 private:
-    struct content {
-        size_t ref_counter;
-        size_t capacity_;
-        T data_[];
+    using content = socow_detail::content<T>;
+    using storage = socow_detail::storage<T>;
+    using encoded = socow_detail::encoded_block<T>;
+
+    friend struct socow_async;
+    friend struct socow_shm_segment;
+    friend struct socow_io;
+    friend struct socow_mapped_file;
+    friend struct std::hash<socow_vector>;
+    template <typename, size_t>
+    friend struct socow_intern_table;
+    template <typename>
+    friend struct socow_concurrent_builder;
+
+    struct uninitialized_t {};
+
+    SOCOW_CONSTEXPR void settle() noexcept {
+        if (pending_) {
+            finish_pending();
+        }
+        if (migrating_) {
+            finish_migration();
+        }
+    }
+
+    SOCOW_COLD void finish_pending() noexcept {
+        socow_detail::pending_copy p = socow_detail::take_pending.load(std::memory_order_acquire)(this);
+        pending_ = false;
+        storage source(static_cast<content*>(p.source));
+        content* c = static_cast<content*>(p.copy);
+        if (c == nullptr) {
+            return;
+        }
+        if (!small && dynamic_storage.content_ptr == source.content_ptr && source.content_ptr->ref_counter > 2) {
+            note_detach();
+            dynamic_storage.~storage();
+            new(&dynamic_storage) storage(c);
+        } else {
+            destruct_range(c->data(), c->data() + size_);
+            storage discard(c);
+        }
+    }
+
+    // Lives right after the elements of the new block. Element i is in the
+    // new block iff i < migrated, i >= old_end or its bit is set; elements
+    // [0, old_size) of the old block stay constructed until the end. Once
+    // filled is filled_done, a const reader has copied all the others too
+    // and the new block may be shared, so the next non-const call retires
+    // the old block before anything else.
+    struct migration {
+        storage old;
+        size_t migrated;
+        size_t old_size;
+        size_t old_end;
+        uint64_t* bits;
+        std::atomic<unsigned char> filled;
     };
 
-    struct storage {
-        content* content_ptr;
+    static constexpr unsigned char filled_none = 0;
+    static constexpr unsigned char filled_busy = 1;
+    static constexpr unsigned char filled_done = 2;
+
+    static constexpr size_t migration_slack = (sizeof(migration) + alignof(migration) + sizeof(T) - 1) / sizeof(T);
+
+    static inline std::atomic<size_t> migration_step_{0};
+
+    // One in eager_copy_probe copies shares even when writes usually follow,
+    // so the adaptive policy notices when they stop.
+    static constexpr size_t eager_copy_probe = 16;
+    static constexpr size_t eager_copy_window = 1024;
+
+    static inline std::atomic<size_t> eager_copy_bytes_{0};
+    static inline std::atomic<bool> eager_copy_adaptive_{false};
+    static inline std::atomic<size_t> shared_copies_{0};
+    static inline std::atomic<size_t> written_copies_{0};
+    static inline std::atomic<size_t> eager_copies_{0};
+
+    static bool eager_candidate(size_t size) noexcept {
+        size_t limit = eager_copy_bytes();
+        return limit != 0 && size * sizeof(T) <= limit;
+    }
+
+    static bool copy_eagerly(socow_vector const& that) noexcept {
+        if (!eager_candidate(that.size_) || that.compressed_ || that.pending_) {
+            return false;
+        }
+        if (!eager_copy_adaptive_.load(std::memory_order_relaxed)) {
+            return true;
+        }
+        size_t shared = shared_copies_.load(std::memory_order_relaxed);
+        size_t written = written_copies_.load(std::memory_order_relaxed);
+        if (written * 4 >= shared * 3 && shared != 0 &&
+            eager_copies_.fetch_add(1, std::memory_order_relaxed) % eager_copy_probe != 0) {
+            return true;
+        }
+        if (shared >= eager_copy_window) {
+            shared_copies_.store(shared / 2, std::memory_order_relaxed);
+            written_copies_.store(written / 2, std::memory_order_relaxed);
+        }
+        shared_copies_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    static storage copy_of(socow_vector const& that) {
+        storage fresh(that.size_);
+        T const* from = that.read_begin();
+        copy(from, from + that.size_, fresh.get());
+        return fresh;
+    }
+
+    // Called on every path that detaches a shared block: in place, through
+    // a migration, or by installing a copy prepared by detach_async.
+    void note_detach() noexcept {
+        if (eager_copy_adaptive_.load(std::memory_order_relaxed) && eager_candidate(size_)) {
+            written_copies_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    migration& migration_state() const noexcept {
+        content* c = dynamic_storage.content_ptr;
+        uintptr_t tail = reinterpret_cast<uintptr_t>(c->data() + c->capacity_);
+        tail = (tail + alignof(migration) - 1) / alignof(migration) * alignof(migration);
+        return *reinterpret_cast<migration*>(tail);
+    }
 
-        storage() : content_ptr(nullptr){}
+    static bool moved(migration const& m, size_t i) noexcept {
+        return i < m.migrated || i >= m.old_end || (m.bits != nullptr && (m.bits[i / 64] >> (i % 64) & 1));
+    }
 
-        explicit storage(size_t capacity) : content_ptr(static_cast<content*>(operator new(sizeof(content) + sizeof(T) * capacity, static_cast<std::align_val_t>(alignof(content))))) {
-            new(&content_ptr->ref_counter) size_t(1);
-            new(&content_ptr->capacity_) size_t(capacity);
+    SOCOW_COLD bool start_migration(size_t new_capacity) {
+        size_t step = migration_step();
+        if (!std::is_nothrow_copy_constructible<T>::value || step == 0 || small || compressed_ || size_ <= step) {
+            return false;
         }
+        storage fresh(new_capacity + migration_slack);
+        fresh.content_ptr->capacity_ = new_capacity;
+        storage old = dynamic_storage;
+        dynamic_storage = fresh;
+        new(&migration_state()) migration{old, 0, size_, size_, nullptr, filled_none};
+        migrating_ = true;
+        return true;
+    }
 
-        storage(storage const& other) : content_ptr(other.content_ptr) {
-            content_ptr->ref_counter++;
+    SOCOW_CONSTEXPR bool detach_incrementally() {
+        if (small || dynamic_storage.unique() || !start_migration(dynamic_storage.content_ptr->capacity_)) {
+            return false;
         }
+        note_detach();
+        return true;
+    }
 
-        storage& operator=(storage const& other) {
-            if (&other != this) {
-                storage tmp(other);
-                std::swap(tmp.content_ptr, this->content_ptr);
+    void advance_migration(size_t budget) noexcept {
+        migration& m = migration_state();
+        T* to = dynamic_storage.get();
+        T const* from = m.old.get();
+        if (whole(m)) {
+            m.migrated = m.old_end;
+        } else if (m.bits == nullptr) {
+            size_t n = std::min(budget, m.old_end - m.migrated);
+            if constexpr (std::is_trivially_copyable<T>::value) {
+                socow_detail::copy_bytes(to + m.migrated, from + m.migrated, sizeof(T) * n);
+            } else {
+                for (size_t i = m.migrated; i != m.migrated + n; ++i) {
+                    new(to + i) T(from[i]);
+                }
+            }
+            m.migrated += n;
+        } else {
+            for (; budget != 0 && m.migrated < m.old_end; ++m.migrated) {
+                if (!moved(m, m.migrated)) {
+                    new(to + m.migrated) T(from[m.migrated]);
+                    --budget;
+                }
             }
-            return *this;
         }
+        if (m.migrated == m.old_end) {
+            if (m.old.unique()) {
+                destruct_range(m.old.get(), m.old.get() + m.old_size);
+            }
+            std::free(m.bits);
+            m.~migration();
+            migrating_ = false;
+        }
+    }
+
+    void drop_migration() noexcept {
+        migration& m = migration_state();
+        if (whole(m)) {
+            finish_migration();
+            return;
+        }
+        if (!std::is_trivially_destructible<T>::value) {
+            for (size_t i = size_; i != 0; --i) {
+                if (moved(m, i - 1)) {
+                    dynamic_storage.get()[i - 1].~T();
+                }
+            }
+        }
+        size_ = 0;
+        m.migrated = m.old_end;
+        advance_migration(0);
+    }
 
-        ~storage() {
-            if (content_ptr->ref_counter == 1) {
-                operator delete(content_ptr, static_cast<std::align_val_t>(alignof(content)));
+    SOCOW_CONSTEXPR T& element_for_write(size_t i) {
+        if (pending_) {
+            finish_pending();
+        }
+        if (!migration_open() && !detach_incrementally()) {
+            update_before_changes();
+            return my_begin()[i];
+        }
+        migration& m = migration_state();
+        if (!moved(m, i)) {
+            if (m.bits == nullptr) {
+                m.bits = static_cast<uint64_t*>(std::calloc((m.old_end + 63) / 64, sizeof(uint64_t)));
+            }
+            if (m.bits == nullptr) {
+                finish_migration();
+                return my_begin()[i];
+            }
+            new(dynamic_storage.get() + i) T(m.old.get()[i]);
+            m.bits[i / 64] |= uint64_t(1) << (i % 64);
+        }
+        T& result = dynamic_storage.get()[i];
+        advance_migration(migration_step());
+        return result;
+    }
+
+    SOCOW_CONSTEXPR T const& element(size_t i) const noexcept(nothrow_reads) {
+        if (compressed_) {
+            return decoded_view()[i];
+        }
+        if (migrating_) {
+            migration const& m = migration_state();
+            return moved(m, i) ? dynamic_storage.get()[i] : m.old.get()[i];
+        }
+        return (small ? static_storage.begin() : dynamic_storage.get())[i];
+    }
+
+    void pop_back_migrating() noexcept {
+        migration& m = migration_state();
+        size_t i = size_ - 1;
+        if (moved(m, i)) {
+            dynamic_storage.get()[i].~T();
+        }
+        if (i < m.old_end) {
+            if (m.bits != nullptr) {
+                m.bits[i / 64] &= ~(uint64_t(1) << (i % 64));
+            }
+            m.old_end = i;
+        }
+        --size_;
+        advance_migration(migration_step());
+    }
+
+    SOCOW_COLD void unpack() {
+        if constexpr (std::is_unsigned<T>::value) {
+            storage fresh(size_);
+            encoded::decode(dynamic_storage.content_ptr, fresh.get());
+            dynamic_storage = fresh;
+            compressed_ = false;
+        }
+    }
+
+    // Const reads of a compressed vector allocate its decoded copy.
+    static constexpr bool nothrow_reads = !std::is_unsigned<T>::value;
+
+    // The decoded copy of a compressed vector. Readers racing to build it
+    // each decode their own, and all but the one that publishes it free
+    // theirs.
+    T const* decoded_view() const {
+        if constexpr (std::is_unsigned<T>::value) {
+            typename encoded::slot& slot = encoded::decoded(dynamic_storage.content_ptr);
+            content* d = slot.load(std::memory_order_acquire);
+            if (d == nullptr) {
+                content* fresh = storage::allocate(size_);
+                encoded::decode(dynamic_storage.content_ptr, fresh->data());
+                if (slot.compare_exchange_strong(d, fresh, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                    d = fresh;
+                } else {
+                    socow_detail::drop(fresh, alignof(content));
+                }
+            }
+            return d->data();
+        }
+        return dynamic_storage.get();
+    }
+
+    // Index of the first e, or size_, decoding only the frames whose range
+    // admits it.
+    size_t find_packed(T const& e) const {
+        content* c = dynamic_storage.content_ptr;
+        socow_detail::codec_ops const* codec = c->ops_->codec;
+        T frame[socow_detail::codec_ops::frame_size];
+        for (size_t k = 0; k != encoded::frames(c); ++k) {
+            if (codec->may_contain(c, k, &e)) {
+                size_t n = codec->decode_frame(c, k, frame);
+                size_t i = socow_detail::find(frame, n, e);
+                if (i != n) {
+                    return k * socow_detail::codec_ops::frame_size + i;
+                }
+            }
+        }
+        return size_;
+    }
+
+    size_t count_packed(T const& e) const {
+        content* c = dynamic_storage.content_ptr;
+        socow_detail::codec_ops const* codec = c->ops_->codec;
+        T frame[socow_detail::codec_ops::frame_size];
+        size_t result = 0;
+        for (size_t k = 0; k != encoded::frames(c); ++k) {
+            if (codec->may_contain(c, k, &e)) {
+                size_t n = codec->decode_frame(c, k, frame);
+                result += socow_detail::count(frame, n, e);
+            }
+        }
+        return result;
+    }
+
+    SOCOW_CONSTEXPR bool migration_open() noexcept {
+        if (migrating_ && whole(migration_state())) {
+            finish_migration();
+        }
+        return migrating_;
+    }
+
+    static bool whole(migration const& m) noexcept {
+        return m.filled.load(std::memory_order_acquire) == filled_done;
+    }
+
+    // Completes the new block for const readers without touching the state
+    // that non-const calls and element() rely on: only the slots element()
+    // still reads from the old block are constructed. Readers that lose the
+    // race wait for the winner.
+    T const* migrated_view() const noexcept {
+        migration& m = migration_state();
+        unsigned char state = filled_none;
+        if (m.filled.compare_exchange_strong(state, filled_busy, std::memory_order_acquire)) {
+            T* to = dynamic_storage.get();
+            T const* from = m.old.get();
+            if (m.bits == nullptr && std::is_trivially_copyable<T>::value) {
+                socow_detail::copy_bytes(to + m.migrated, from + m.migrated, sizeof(T) * (m.old_end - m.migrated));
             } else {
-                content_ptr->ref_counter--;
+                for (size_t i = m.migrated; i < m.old_end; ++i) {
+                    if (!moved(m, i)) {
+                        new(to + i) T(from[i]);
+                    }
+                }
+            }
+            m.filled.store(filled_done, std::memory_order_release);
+        } else {
+            while (!whole(m)) {
             }
         }
+        return dynamic_storage.get();
+    }
 
-        T* get() {
-            return content_ptr->data_;
+    SOCOW_CONSTEXPR T const* read_begin() const noexcept(nothrow_reads) {
+        if (migrating_) {
+            return migrated_view();
         }
-        T* get() const {
-            return content_ptr->data_;
+        if (compressed_) {
+            return decoded_view();
         }
-        bool unique() {
-            return content_ptr->ref_counter == 1;
+        return (small ? static_storage.begin() : dynamic_storage.get());
+    }
+
+    socow_vector(content* shared, size_t size) noexcept
+        : size_(size), small(false) {
+        new(&dynamic_storage) storage(shared);
+        profile_start();
+    }
+
+    socow_vector(size_t size, uninitialized_t) : size_(size), small(size <= SMALL_SIZE) {
+        if (!small) {
+            new(&dynamic_storage) storage(size);
         }
-    };
-    void create_storage(size_t new_cap) {
+        profile_start();
+    }
+
+    SOCOW_COLD void create_storage(size_t new_cap) {
         storage new_st = realloc(new_cap, my_begin(), my_end());
         destruct_range(my_begin(), my_end());
         new(&dynamic_storage) storage(new_st);
         small = false;
+        profile_move(true);
+    }
+    // Gives the vector sole ownership of room for n elements and returns
+    // whether the elements past size() are already zero.
+    bool make_room(size_t n, bool zeroed) {
+        settle();
+        if (compressed_) {
+            unpack();
+        }
+        size_t cap = capacity();
+        bool shared = !small && !dynamic_storage.unique();
+        if (n <= cap && !shared) {
+            if (!small) {
+                dynamic_storage.invalidate_hash();
+            }
+            return false;
+        }
+        if (shared) {
+            note_detach();
+        }
+        zeroed = zeroed && socow_detail::zero_is_value<T>::value;
+        size_t new_cap = n <= cap ? cap : std::max(n, size_ * 2);
+        bool was_small = small;
+        storage fresh = realloc(new_cap, my_begin(), my_end(), zeroed);
+        if (was_small) {
+            destruct_range(my_begin(), my_end());
+            small = false;
+            profile_move(true);
+        }
+        new(&dynamic_storage) storage(fresh);
+        return zeroed;
+    }
+
+    void truncate(size_t n) {
+        if (n == size_) {
+            return;
+        }
+        update_before_changes();
+        destruct_range(my_begin() + n, my_end());
+        size_ = n;
     }
-    void update_before_changes() {
-        if (!small && !dynamic_storage.unique())
+
+    // Only blocks whose elements follow the header in memory we allocated
+    // may move their first element.
+    bool front_adjustable() noexcept {
+        if (small || !dynamic_storage.unique()) {
+            return false;
+        }
+        auto ops = dynamic_storage.content_ptr->ops_;
+        return ops == nullptr || ops->movable_front;
+    }
+
+    size_t front_slack() noexcept {
+        return static_cast<size_t>(dynamic_storage.get() - dynamic_storage.content_ptr->data_);
+    }
+
+    void move_front(T* p) noexcept {
+        content* c = dynamic_storage.content_ptr;
+        c->capacity_ += c->data() - p;
+        c->set_data(p);
+        c->hashed_ = false;
+    }
+
+    SOCOW_CONSTEXPR void update_before_changes() {
+        settle();
+        if (compressed_) {
+            unpack();
+        }
+        if (!small && !dynamic_storage.unique()) {
+            note_detach();
             new(&dynamic_storage) storage(realloc(
                 dynamic_storage.content_ptr->capacity_, my_begin(), my_end()));
+        } else if (!small) {
+            dynamic_storage.invalidate_hash();
+        }
+    }
+
+    size_t hash() const {
+        if (migrating_) {
+            return socow_detail::hash(migrated_view(), size_);
+        }
+        if (compressed_) {
+            return socow_detail::hash(decoded_view(), size_);
+        }
+        if (small) {
+            return socow_detail::hash(begin(), size_);
+        }
+        // Only a shared block is cached: a uniquely owned one may still be
+        // written through an iterator handed out before the hash was taken.
+        content* c = dynamic_storage.content_ptr;
+        bool shared = c->ref_counter > 1 && c->ref_counter != content::frozen;
+        if (shared && c->hashed_) {
+            return c->hash_;
+        }
+        size_t h = socow_detail::hash(c->data(), size_);
+        if (shared) {
+            c->hash_ = h;
+            c->hashed_ = true;
+        }
+        return h;
     }
-    void big_to_small() {
+    SOCOW_COLD void big_to_small() {
         storage tmp = dynamic_storage;
         dynamic_storage.~storage();
         try {
@@ -279,9 +1762,73 @@ private:
         }
         destruct_range(tmp.get(), tmp.get() + size_);
         small = true;
+        profile_move(false);
+    }
+
+    SOCOW_CONSTEXPR void profile_start() noexcept {
+#if defined(SOCOW_PROFILE)
+        if (!socow_detail::constant_evaluated() && socow_profile::sample()) {
+            profiled_ = socow_profile::track(typeid(T).name(), sizeof(T), SMALL_SIZE, sizeof(content), size_);
+        }
+#endif
+    }
+
+    SOCOW_CONSTEXPR void profile_size() noexcept {
+#if defined(SOCOW_PROFILE)
+        if (profiled_) {
+            profiled_->resized(size_);
+        }
+#endif
+    }
+
+    void profile_move(bool to_heap) noexcept {
+#if defined(SOCOW_PROFILE)
+        if (profiled_) {
+            profiled_->moved(to_heap);
+        }
+#else
+        (void)to_heap;
+#endif
+    }
+
+    SOCOW_CONSTEXPR void profile_end() noexcept {
+#if defined(SOCOW_PROFILE)
+        if (profiled_) {
+            socow_profile::untrack(profiled_, size_);
+            profiled_ = nullptr;
+        }
+#endif
     }
 
-    void copy(T const* start, T const* ending, T* destination) {
+    SOCOW_CONSTEXPR static void construct(T* p, T const& e) {
+        if constexpr (socow_detail::constexpr_storable<T>) {
+            if (socow_detail::constant_evaluated()) {
+                *p = e;
+                return;
+            }
+        }
+        new (p) T(e);
+    }
+
+    SOCOW_CONSTEXPR static void copy(T const* start, T const* ending, T* destination) {
+        if constexpr (socow_detail::constexpr_storable<T>) {
+            if (socow_detail::constant_evaluated()) {
+                for (T const* it = start; it != ending; it++) {
+                    destination[it - start] = *it;
+                }
+                return;
+            }
+        }
+        // Other element types stay serial: their copy constructors may touch
+        // shared state, such as the reference counts of nested vectors.
+        if constexpr (std::is_trivially_copyable<T>::value) {
+            size_t bytes = sizeof(T) * static_cast<size_t>(ending - start);
+            auto split = socow_detail::parallel_copy.load(std::memory_order_relaxed);
+            if (split == nullptr || !split(destination, start, bytes)) {
+                socow_detail::copy_bytes(destination, start, bytes);
+            }
+            return;
+        }
         for (T const* it = start; it < ending; it++) {
             try {
                 new(destination + (it - start)) T(*it);
@@ -305,14 +1852,14 @@ private:
         new(&sm.dynamic_storage) storage(tmp);
     }
 
-    storage realloc(size_t new_capacity, const_iterator start, const_iterator e) {
+    SOCOW_COLD storage realloc(size_t new_capacity, const_iterator start, const_iterator e, bool zeroed = false) {
         if (new_capacity == 0) {
             small = true;
             storage empty;
             return empty;
         }
         size_ = e - start;
-        storage new_st(new_capacity);
+        storage new_st = zeroed ? storage(storage::allocate_zeroed(new_capacity)) : storage(new_capacity);
         copy(start, e, new_st.get());
         if (!small) {
             if (dynamic_storage.get() != nullptr && dynamic_storage.unique()) {
@@ -323,8 +1870,8 @@ private:
         }
         return new_st;
     }
-    static void destruct_range(T* start, T* end) noexcept {
-        if (start == nullptr || end == nullptr) {
+    SOCOW_CONSTEXPR static void destruct_range(T* start, T* end) noexcept {
+        if (start == nullptr || end == nullptr || socow_detail::constant_evaluated()) {
             return;
         }
         for (T* it = --end; it >= start; it--) {
@@ -335,8 +1882,27 @@ private:
 private:
     size_t size_;
     bool small;
+    bool pending_ = false;
+    bool migrating_ = false;
+    bool compressed_ = false;
+#if defined(SOCOW_PROFILE)
+    socow_profile::tracked* profiled_ = nullptr;
+#endif
     union {
         std::array<T, SMALL_SIZE> static_storage;
         storage dynamic_storage;
     };
 };
+
+namespace std {
+template <typename T, size_t SMALL_SIZE>
+struct hash<socow_vector<T, SMALL_SIZE>> {
+    size_t operator()(socow_vector<T, SMALL_SIZE> const& v) const {
+        return v.hash();
+    }
+};
+} // namespace std
+
+// Flags packed into words; defined in socow-bitvector.h.
+template <size_t SMALL_SIZE>
+struct socow_vector<bool, SMALL_SIZE>;
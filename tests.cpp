@@ -1,7 +1,26 @@
+#include <numeric>
+#include <thread>
 #include <unordered_set>
 
+#include <sys/wait.h>
+
 #include "gtest/gtest.h"
 
+#include "socow-async.h"
+#include "socow-bitvector.h"
+#include "socow-builder.h"
+#include "socow-flat.h"
+#include "socow-intern.h"
+#include "socow-io.h"
+#include "socow-jagged.h"
+#include "socow-mmap.h"
+#include "socow-packed.h"
+#include "socow-parallel.h"
+#include "socow-pool.h"
+#include "socow-shm.h"
+#include "socow-simd.h"
+#include "socow-soa.h"
+#include "socow-string.h"
 #include "socow-vector.h"
 
 template struct socow_vector<int, 2>;
@@ -1314,3 +1333,1857 @@ TEST(small_object, erase_big_into_small_3) {
     EXPECT_THROW(a.erase(as_const(a).begin() + 2, as_const(a).end() - 1),
                  std::runtime_error);
 }
+
+TEST(shm, publish_attach) {
+    socow_shm_segment seg = socow_shm_segment::create_anonymous(1 << 16);
+    socow_vector<int, 2> a;
+    for (int i = 0; i != 1000; ++i)
+        a.push_back(i * 3);
+
+    size_t offset = seg.publish(a);
+    socow_vector<int, 2> b = seg.attach<int, 2>(offset);
+    socow_vector<int, 4> c = seg.attach<int, 4>(offset);
+    ASSERT_EQ(1000, b.size());
+    ASSERT_EQ(1000, c.size());
+    EXPECT_EQ(as_const(b).data(), as_const(c).data());
+    for (int i = 0; i != 1000; ++i)
+        EXPECT_EQ(i * 3, as_const(b)[i]);
+}
+
+TEST(shm, attach_small) {
+    socow_shm_segment seg = socow_shm_segment::create_anonymous(1 << 12);
+    socow_vector<int, 2> a;
+    a.push_back(7);
+    a.push_back(8);
+
+    socow_vector<int, 2> b = seg.attach<int, 2>(seg.publish(a));
+    EXPECT_EQ(2, b.size());
+    EXPECT_EQ(2, b.capacity());
+    EXPECT_EQ(8, as_const(b)[1]);
+    EXPECT_THROW((seg.attach<short, 2>(seg.publish(a))), std::invalid_argument);
+}
+
+TEST(shm, failed_create_unlinks_name) {
+    std::string name = "/socow-test-" + std::to_string(getpid());
+    EXPECT_THROW(socow_shm_segment::create(name, static_cast<size_t>(-1)), std::system_error);
+    EXPECT_THROW(socow_shm_segment::open(name), std::system_error);
+}
+
+TEST(shm, mutation_detaches) {
+    socow_shm_segment seg = socow_shm_segment::create_anonymous(1 << 16);
+    socow_vector<int, 2> a;
+    for (int i = 0; i != 100; ++i)
+        a.push_back(i);
+    size_t offset = seg.publish(a);
+
+    socow_shm_segment ro = socow_shm_segment::open_fd(seg.fd());
+    EXPECT_FALSE(ro.writable());
+    {
+        socow_vector<int, 2> b = ro.attach<int, 2>(offset);
+        socow_vector<int, 2> c = b;
+        int const* shared = as_const(b).data();
+        EXPECT_EQ(shared, as_const(c).data());
+
+        b[0] = 42;
+        EXPECT_NE(shared, as_const(b).data());
+        EXPECT_EQ(shared, as_const(c).data());
+        EXPECT_EQ(0, as_const(c)[0]);
+
+        c.push_back(100);
+        EXPECT_EQ(101, c.size());
+        EXPECT_EQ(100, as_const(c).back());
+    }
+    socow_vector<int, 2> const d = ro.attach<int, 2>(offset);
+    EXPECT_EQ(0, d[0]);
+    EXPECT_THROW(ro.publish(a), std::logic_error);
+}
+
+TEST(shm, other_process) {
+    socow_shm_segment seg = socow_shm_segment::create_anonymous(1 << 16);
+    socow_vector<size_t, 2> a;
+    for (size_t i = 0; i != 500; ++i)
+        a.push_back(i * i);
+    size_t offset = seg.publish(a);
+
+    pid_t pid = fork();
+    ASSERT_NE(-1, pid);
+    if (pid == 0) {
+        int status = 0;
+        {
+            socow_shm_segment ro = socow_shm_segment::open_fd(seg.fd());
+            socow_vector<size_t, 2> b = ro.attach<size_t, 2>(offset);
+            for (size_t i = 0; i != 500; ++i)
+                status |= as_const(b)[i] != i * i;
+            b.push_back(1);
+            status |= b.size() != 501;
+        }
+        _exit(status);
+    }
+    int status;
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+    ASSERT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(0, WEXITSTATUS(status));
+}
+
+TEST(shm, out_of_space) {
+    socow_shm_segment seg = socow_shm_segment::create_anonymous(256);
+    socow_vector<size_t, 2> a;
+    for (size_t i = 0; i != 500; ++i)
+        a.push_back(i);
+    EXPECT_THROW(seg.publish(a), std::bad_alloc);
+}
+
+TEST(comparison, equal) {
+    socow_vector<int, 2> a, b;
+    EXPECT_TRUE(a == b);
+    for (int i = 0; i != 100; ++i) {
+        a.push_back(i);
+        b.push_back(i);
+    }
+    EXPECT_TRUE(a == b);
+    EXPECT_FALSE(a != b);
+    b[97] = -1;
+    EXPECT_FALSE(a == b);
+    b.pop_back();
+    EXPECT_TRUE(a != b);
+}
+
+TEST(comparison, equal_shared_no_detach) {
+    container a;
+    for (size_t i = 0; i != 10; ++i)
+        a.push_back(i);
+    container b = a;
+
+    element<size_t>::set_copy_counter(0);
+    EXPECT_TRUE(a == b);
+    EXPECT_EQ(0, element<size_t>::get_copy_counter());
+    EXPECT_EQ(as_const(a).data(), as_const(b).data());
+}
+
+TEST(comparison, ordering) {
+    socow_vector<uint8_t, 4> a, b;
+    for (int i = 0; i != 70; ++i) {
+        a.push_back(i);
+        b.push_back(i);
+    }
+    EXPECT_FALSE(a < b);
+    EXPECT_TRUE(a <= b);
+    b[65] = 200;
+    EXPECT_TRUE(a < b);
+    EXPECT_TRUE(b > a);
+    EXPECT_FALSE(b <= a);
+    a.pop_back();
+    b = a;
+    b.push_back(0);
+    EXPECT_TRUE(a < b);
+    EXPECT_TRUE(b >= a);
+
+    socow_vector<int, 2> c, d;
+    c.push_back(-1);
+    d.push_back(1);
+    EXPECT_TRUE(c < d);
+}
+
+TEST(comparison, find_count) {
+    socow_vector<uint16_t, 2> a;
+    for (int i = 0; i != 1000; ++i)
+        a.push_back(i % 100);
+    socow_vector<uint16_t, 2> b = a;
+
+    EXPECT_EQ(as_const(a).begin() + 57, a.find(57));
+    EXPECT_EQ(as_const(a).end(), a.find(100));
+    EXPECT_EQ(10, a.count(99));
+    EXPECT_TRUE(a.contains(0));
+    EXPECT_FALSE(a.contains(1000));
+    EXPECT_EQ(as_const(a).data(), as_const(b).data());
+}
+
+TEST(comparison, find_all_widths) {
+    socow_vector<char, 8> c;
+    socow_vector<uint32_t, 8> u;
+    socow_vector<int64_t, 8> l;
+    socow_vector<double, 8> d;
+    for (int i = 0; i != 131; ++i) {
+        c.push_back('a' + i % 26);
+        u.push_back(i);
+        l.push_back(-i);
+        d.push_back(i * 0.5);
+    }
+    for (int i = 0; i != 131; ++i) {
+        EXPECT_EQ(i, u.find(i) - as_const(u).begin());
+        EXPECT_EQ(i, l.find(-i) - as_const(l).begin());
+        EXPECT_EQ(i, d.find(i * 0.5) - as_const(d).begin());
+    }
+    EXPECT_EQ(25, c.find('z') - as_const(c).begin());
+    EXPECT_EQ(6, c.count('a'));
+    EXPECT_EQ(1, d.count(-0.0));
+}
+
+TEST(comparison, floating_point) {
+    socow_vector<double, 2> a, b;
+    a.push_back(0.0);
+    b.push_back(-0.0);
+    EXPECT_TRUE(a == b);
+    a.push_back(std::numeric_limits<double>::quiet_NaN());
+    b.push_back(std::numeric_limits<double>::quiet_NaN());
+    a.push_back(1);
+    b.push_back(2);
+    EXPECT_FALSE(a == b);
+    EXPECT_FALSE(a.contains(std::numeric_limits<double>::quiet_NaN()));
+    EXPECT_TRUE(a < b);
+}
+
+TEST(comparison, find_elements) {
+    container a;
+    for (size_t i = 0; i != 20; ++i)
+        a.push_back(i % 5);
+    container b = a;
+
+    element<size_t>::set_copy_counter(0);
+    EXPECT_EQ(3, a.find(3) - as_const(a).begin());
+    EXPECT_EQ(4, a.count(3));
+    EXPECT_FALSE(a.contains(5));
+    EXPECT_EQ(0, element<size_t>::get_copy_counter());
+    EXPECT_EQ(as_const(a).data(), as_const(b).data());
+}
+
+#ifdef SOCOW_SIMD_X86
+TEST(comparison, sse2_kernels) {
+    socow_vector<uint64_t, 2> a;
+    for (uint64_t i = 0; i != 77; ++i)
+        a.push_back(i << 33);
+    socow_vector<uint64_t, 2> b = a;
+    b[70] += 1;
+
+    EXPECT_EQ(70, socow_simd::mismatch_sse2<uint64_t>(as_const(a).data(), as_const(b).data(), 77));
+    EXPECT_EQ(76, socow_simd::find_sse2<uint64_t>(as_const(a).data(), 77, uint64_t(76) << 33));
+    EXPECT_EQ(77, socow_simd::find_sse2<uint64_t>(as_const(a).data(), 77, 1));
+    EXPECT_EQ(1, socow_simd::count_sse2<uint64_t>(as_const(a).data(), 77, uint64_t(3) << 33));
+}
+#endif
+
+TEST(comparison, scans_without_simd_header) {
+    using scan_ops = socow_detail::scan_ops<uint32_t>;
+    scan_ops const* installed = socow_detail::scans<uint32_t>.exchange(nullptr);
+    socow_vector<uint32_t, 2> a;
+    for (uint32_t i = 0; i != 100; ++i)
+        a.push_back(i % 7);
+    socow_vector<uint32_t, 2> b = a;
+    b.push_back(1);
+
+    EXPECT_EQ(3, a.find(3) - as_const(a).begin());
+    EXPECT_EQ(15, a.count(0));
+    EXPECT_FALSE(a.contains(7));
+    EXPECT_FALSE(a == b);
+    EXPECT_TRUE(a < b);
+    b.pop_back();
+    EXPECT_TRUE(a == b);
+    socow_detail::scans<uint32_t>.store(installed);
+}
+
+TEST(hash, equal_vectors) {
+    std::hash<socow_vector<uint32_t, 4>> hasher;
+    socow_vector<uint32_t, 4> a, b;
+    EXPECT_EQ(hasher(a), hasher(b));
+    for (uint32_t i = 0; i != 1000; ++i) {
+        a.push_back(i * 7);
+        b.push_back(i * 7);
+        EXPECT_EQ(hasher(a), hasher(b));
+    }
+    b.pop_back();
+    EXPECT_NE(hasher(a), hasher(b));
+}
+
+TEST(hash, cache_invalidation) {
+    std::hash<socow_vector<uint64_t, 2>> hasher;
+    socow_vector<uint64_t, 2> a;
+    for (uint64_t i = 0; i != 100; ++i)
+        a.push_back(i);
+    size_t h = hasher(a);
+    socow_vector<uint64_t, 2> b = a;
+    EXPECT_EQ(h, hasher(b));
+
+    b[5] = 1000;
+    size_t hb = hasher(b);
+    EXPECT_NE(h, hb);
+    EXPECT_EQ(h, hasher(a));
+
+    a[5] = 1000;
+    EXPECT_EQ(hb, hasher(a));
+    a.push_back(1);
+    EXPECT_NE(hb, hasher(a));
+    a.pop_back();
+    EXPECT_EQ(hb, hasher(a));
+    *a.begin() = 7;
+    EXPECT_NE(hb, hasher(a));
+    a.clear();
+    EXPECT_EQ(hasher(socow_vector<uint64_t, 2>()), hasher(a));
+}
+
+TEST(hash, unique_block_written_through_old_iterator) {
+    std::hash<socow_vector<uint64_t, 2>> hasher;
+    socow_vector<uint64_t, 2> v;
+    socow_vector<uint64_t, 2> w;
+    for (uint64_t i = 0; i != 50; ++i) {
+        v.push_back(i);
+        w.push_back(i == 3 ? 7 : i);
+    }
+    auto it = v.begin() + 3;
+    hasher(v);
+    *it = 7;
+    EXPECT_TRUE(v == w);
+    EXPECT_EQ(hasher(w), hasher(v));
+}
+
+TEST(hash, unordered_set_keys) {
+    std::unordered_set<socow_vector<uint32_t, 4>> set;
+    socow_vector<uint32_t, 4> key;
+    for (uint32_t i = 0; i != 64; ++i) {
+        key.push_back(i);
+        set.insert(key);
+    }
+    EXPECT_EQ(64, set.size());
+    socow_vector<uint32_t, 4> probe;
+    for (uint32_t i = 0; i != 10; ++i)
+        probe.push_back(i);
+    EXPECT_EQ(1, set.count(probe));
+    probe.push_back(100);
+    EXPECT_EQ(0, set.count(probe));
+}
+
+TEST(hash, non_trivial_elements) {
+    std::hash<socow_vector<std::string, 2>> hasher;
+    socow_vector<std::string, 2> a, b;
+    for (int i = 0; i != 10; ++i) {
+        a.push_back(std::to_string(i));
+        b.push_back(std::to_string(i));
+    }
+    EXPECT_EQ(hasher(a), hasher(b));
+    b[3] = "x";
+    EXPECT_NE(hasher(a), hasher(b));
+}
+
+namespace {
+struct temp_file {
+    temp_file() {
+        char name[] = "/tmp/socow-vector-XXXXXX";
+        fd = mkstemp(name);
+        unlink(name);
+    }
+    ~temp_file() {
+        close(fd);
+    }
+    void rewind() const {
+        lseek(fd, 0, SEEK_SET);
+    }
+    int fd;
+};
+} // namespace
+
+TEST(io, round_trip) {
+    temp_file f;
+    socow_vector<uint32_t, 4> big, small, empty;
+    for (uint32_t i = 0; i != 1000; ++i)
+        big.push_back(i * i);
+    small.push_back(5);
+    small.push_back(6);
+
+    socow_io::write(f.fd, big);
+    socow_io::write(f.fd, small);
+    socow_io::write(f.fd, empty);
+    f.rewind();
+
+    auto a = socow_io::read<socow_vector<uint32_t, 4>>(f.fd);
+    auto b = socow_io::read<socow_vector<uint32_t, 4>>(f.fd);
+    auto c = socow_io::read<socow_vector<uint32_t, 4>>(f.fd);
+    EXPECT_TRUE(a == big);
+    EXPECT_EQ(1000, a.capacity());
+    EXPECT_TRUE(b == small);
+    EXPECT_EQ(4, b.capacity());
+    EXPECT_TRUE(c.empty());
+    EXPECT_THROW((socow_io::read<socow_vector<uint32_t, 4>>(f.fd)), std::runtime_error);
+}
+
+TEST(io, type_mismatch) {
+    temp_file f;
+    socow_vector<uint32_t, 4> a;
+    a.push_back(1);
+    socow_io::write(f.fd, a);
+    f.rewind();
+    EXPECT_THROW((socow_io::read<socow_vector<uint64_t, 4>>(f.fd)), std::runtime_error);
+    f.rewind();
+    EXPECT_THROW((socow_io::read<socow_vector<uint16_t, 4>>(f.fd)), std::runtime_error);
+}
+
+TEST(io, crafted_sizes_rejected) {
+    for (uint64_t size : {uint64_t(SIZE_MAX / 4), uint64_t(SIZE_MAX / 4 - 20), uint64_t(1) << 40, uint64_t(3)}) {
+        temp_file f;
+        socow_io::header h{socow_io::magic, socow_io::version, sizeof(uint32_t), alignof(uint32_t), size, 0};
+        uint32_t data[2] = {1, 2};
+        ASSERT_EQ(ssize_t(sizeof(h)), ::write(f.fd, &h, sizeof(h)));
+        ASSERT_EQ(ssize_t(sizeof(data)), ::write(f.fd, data, sizeof(data)));
+        f.rewind();
+        EXPECT_THROW((socow_io::read<socow_vector<uint32_t, 4>>(f.fd)), std::runtime_error);
+    }
+    socow_vector<uint32_t, 4> v;
+    EXPECT_THROW(v.reserve(SIZE_MAX / 4 - 2), std::length_error);
+    EXPECT_THROW(v.resize(SIZE_MAX / 2), std::length_error);
+    EXPECT_TRUE(v.empty());
+}
+
+TEST(io, batch) {
+    temp_file f;
+    std::vector<socow_vector<double, 2>> batch(3000);
+    for (size_t i = 0; i != batch.size(); ++i)
+        for (size_t j = 0; j != i % 7; ++j)
+            batch[i].push_back(i + j * 0.5);
+    socow_vector<double, 2> shared = batch[6];
+
+    socow_io::write_batch(f.fd, batch.begin(), batch.end());
+    EXPECT_EQ(as_const(shared).data(), as_const(batch[6]).data());
+    f.rewind();
+    for (size_t i = 0; i != batch.size(); ++i)
+        EXPECT_TRUE((socow_io::read<socow_vector<double, 2>>(f.fd) == batch[i]));
+}
+
+namespace {
+std::string temp_path() {
+    char name[] = "/tmp/socow-vector-XXXXXX";
+    close(mkstemp(name));
+    unlink(name);
+    return name;
+}
+} // namespace
+
+TEST(mapped_file, open_read_only) {
+    std::string path = temp_path();
+    socow_vector<uint32_t, 4> a;
+    for (uint32_t i = 0; i != 5000; ++i)
+        a.push_back(i * 3);
+    {
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+        socow_io::write(fd, a);
+        close(fd);
+    }
+    {
+        socow_vector<uint32_t, 4> b = socow_mapped_file::open<uint32_t, 4>(path);
+        EXPECT_TRUE(socow_mapped_file::is_mapped(b));
+        EXPECT_TRUE(a == b);
+        socow_vector<uint32_t, 4> c = b;
+
+        b[0] = 42;
+        EXPECT_EQ(0, as_const(c)[0]);
+        c[1] = 7;
+        EXPECT_TRUE(socow_mapped_file::is_mapped(c));
+        EXPECT_EQ(7, as_const(c)[1]);
+        c.push_back(1);
+        EXPECT_FALSE(socow_mapped_file::is_mapped(c));
+        EXPECT_EQ(5001, c.size());
+        EXPECT_THROW(socow_mapped_file::sync(b), std::logic_error);
+    }
+    socow_vector<uint32_t, 4> d = socow_mapped_file::open<uint32_t, 4>(path);
+    EXPECT_TRUE(a == d);
+    EXPECT_THROW((socow_mapped_file::open<uint64_t, 4>(path)), std::runtime_error);
+    unlink(path.c_str());
+}
+
+TEST(mapped_file, small_is_inline) {
+    std::string path = temp_path();
+    socow_vector<int, 4> a;
+    a.push_back(1);
+    a.push_back(2);
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+    socow_io::write(fd, a);
+    close(fd);
+
+    socow_vector<int, 4> b = socow_mapped_file::open<int, 4>(path);
+    EXPECT_FALSE(socow_mapped_file::is_mapped(b));
+    EXPECT_EQ(4, b.capacity());
+    EXPECT_TRUE(a == b);
+    unlink(path.c_str());
+}
+
+TEST(mapped_file, writable_grows) {
+    std::string path = temp_path();
+    {
+        socow_vector<uint64_t, 2> a = socow_mapped_file::open_writable<uint64_t, 2>(path);
+        EXPECT_TRUE(socow_mapped_file::is_mapped(a));
+        for (uint64_t i = 0; i != 10000; ++i)
+            a.push_back(i);
+        a.push_back(a[0]);
+        EXPECT_TRUE(socow_mapped_file::is_mapped(a));
+        socow_mapped_file::sync(a);
+
+        socow_vector<uint64_t, 2> copy = a;
+        copy.push_back(5);
+        EXPECT_FALSE(socow_mapped_file::is_mapped(copy));
+        EXPECT_EQ(10001, a.size());
+    }
+    {
+        socow_vector<uint64_t, 2> a = socow_mapped_file::open_writable<uint64_t, 2>(path);
+        ASSERT_EQ(10001, a.size());
+        for (uint64_t i = 0; i != 10000; ++i)
+            EXPECT_EQ(i, as_const(a)[i]);
+        EXPECT_EQ(0, as_const(a).back());
+        a[5] = 500;
+        socow_mapped_file::sync(a);
+    }
+    socow_vector<uint64_t, 2> b = socow_mapped_file::open<uint64_t, 2>(path);
+    EXPECT_EQ(500, as_const(b)[5]);
+    unlink(path.c_str());
+}
+
+TEST(adopt, std_vector) {
+    std::vector<int> source(1000);
+    for (int i = 0; i != 1000; ++i)
+        source[i] = i;
+    int const* buffer = source.data();
+
+    socow_vector<int, 4> a(std::move(source));
+    EXPECT_EQ(1000, a.size());
+    EXPECT_EQ(buffer, as_const(a).data());
+    EXPECT_EQ(999, as_const(a).back());
+
+    a[0] = 5;
+    a.pop_back();
+    EXPECT_EQ(buffer, as_const(a).data());
+
+    std::vector<int> back = a.into_vector();
+    EXPECT_EQ(buffer, back.data());
+    EXPECT_EQ(999, back.size());
+    EXPECT_EQ(5, back[0]);
+    EXPECT_TRUE(a.empty());
+}
+
+TEST(adopt, std_vector_small_and_shared) {
+    std::vector<int> source = {1, 2, 3};
+    socow_vector<int, 4> a(std::move(source));
+    EXPECT_EQ(4, a.capacity());
+    EXPECT_EQ(3, as_const(a)[2]);
+
+    std::vector<int> big(100, 7);
+    socow_vector<int, 4> b(std::move(big));
+    socow_vector<int, 4> c = b;
+    std::vector<int> out = b.into_vector();
+    EXPECT_EQ(100, out.size());
+    EXPECT_NE(as_const(c).data(), out.data());
+    EXPECT_EQ(100, c.size());
+    EXPECT_TRUE(b.empty());
+
+    c.push_back(8);
+    EXPECT_EQ(101, c.size());
+    EXPECT_EQ(8, as_const(c).back());
+}
+
+TEST(adopt, unique_ptr) {
+    static size_t deleted = 0;
+    struct counting_delete {
+        void operator()(double* p) const {
+            ++deleted;
+            delete[] p;
+        }
+    };
+    std::unique_ptr<double[], counting_delete> source(new double[500]);
+    for (size_t i = 0; i != 500; ++i)
+        source[i] = i * 0.5;
+    double const* buffer = source.get();
+    {
+        socow_vector<double, 2> a(std::move(source), 500);
+        EXPECT_EQ(nullptr, source.get());
+        EXPECT_EQ(buffer, as_const(a).data());
+        socow_vector<double, 2> b = a;
+        b[1] = -1;
+        EXPECT_EQ(0.5, as_const(a)[1]);
+        EXPECT_EQ(0, deleted);
+    }
+    EXPECT_EQ(1, deleted);
+}
+
+TEST(adopt, release) {
+    container a;
+    for (size_t i = 0; i != 10; ++i)
+        a.push_back(i);
+    element<size_t> const* p = as_const(a).data();
+    {
+        container::buffer buffer = a.release();
+        EXPECT_EQ(p, buffer.get());
+        EXPECT_EQ(9, buffer[9]);
+        EXPECT_TRUE(a.empty());
+        EXPECT_EQ(2, a.capacity());
+    }
+    element<size_t>::expect_no_instances();
+
+    container b;
+    b.push_back(1);
+    container::buffer small = b.release();
+    EXPECT_EQ(1, small[0]);
+
+    container c;
+    for (size_t i = 0; i != 10; ++i)
+        c.push_back(i);
+    container d = c;
+    container::buffer shared = c.release();
+    EXPECT_NE(as_const(d).data(), shared.get());
+    EXPECT_EQ(10, d.size());
+}
+
+struct pool_enabled {
+    pool_enabled() {
+        socow_block_pool::set_enabled(true);
+    }
+
+    ~pool_enabled() {
+        socow_block_pool::trim();
+        socow_block_pool::set_limits(64, size_t(1) << 20);
+        socow_block_pool::set_enabled(false);
+    }
+};
+
+TEST(pool, reuses_blocks) {
+    pool_enabled guard;
+    socow_vector<int, 2> a;
+    for (int i = 0; i != 10; ++i)
+        a.push_back(i);
+    socow_block_pool::trim();
+    int const* p = as_const(a).data();
+    socow_vector<int, 2> b = a;
+    b[0] = 1;
+    EXPECT_NE(p, as_const(b).data());
+    a = socow_vector<int, 2>();
+    EXPECT_EQ(1, socow_block_pool::cached_blocks());
+
+    socow_vector<int, 2> c = b;
+    c[0] = 2;
+    EXPECT_EQ(p, as_const(c).data());
+    EXPECT_EQ(0, socow_block_pool::cached_blocks());
+    EXPECT_EQ(1, as_const(b)[0]);
+    EXPECT_EQ(9, as_const(c)[9]);
+}
+
+TEST(pool, limits_and_trim) {
+    pool_enabled guard;
+    socow_block_pool::set_limits(2, 4096);
+    socow_vector<int, 2> small;
+    socow_vector<int, 2> big;
+    for (int i = 0; i != 2000; ++i) {
+        if (i < 10)
+            small.push_back(i);
+        big.push_back(i);
+    }
+    socow_block_pool::trim();
+    {
+        std::vector<socow_vector<int, 2>> copies(5, small);
+        copies.push_back(big);
+        for (auto& v : copies)
+            v[0] = -1;
+    }
+    EXPECT_EQ(2, socow_block_pool::cached_blocks());
+    socow_block_pool::trim();
+    EXPECT_EQ(0, socow_block_pool::cached_blocks());
+}
+
+TEST(pool, cross_thread_free) {
+    pool_enabled guard;
+    socow_vector<int, 2> source;
+    for (int i = 0; i != 10; ++i)
+        source.push_back(i);
+    socow_vector<int, 2> a = source;
+    a[0] = 1;
+    socow_block_pool::trim();
+    int const* p = as_const(a).data();
+    std::thread([copy = a]() mutable {
+        EXPECT_EQ(9, as_const(copy)[9]);
+    }).join();
+    std::thread([&a]() {
+        socow_vector<int, 2> last = a;
+        a = socow_vector<int, 2>();
+    }).join();
+    EXPECT_EQ(0, socow_block_pool::cached_blocks());
+
+    socow_vector<int, 2> b = source;
+    b[0] = 2;
+    EXPECT_EQ(p, as_const(b).data());
+}
+
+TEST(pool, outlives_thread) {
+    pool_enabled guard;
+    socow_vector<int, 2> a;
+    std::thread([&a]() {
+        socow_vector<int, 2> local;
+        for (int i = 0; i != 10; ++i)
+            local.push_back(i);
+        a = local;
+    }).join();
+    EXPECT_EQ(9, as_const(a)[9]);
+    socow_vector<int, 2> b = a;
+    a = socow_vector<int, 2>();
+    EXPECT_EQ(10, b.size());
+    b = socow_vector<int, 2>();
+    EXPECT_EQ(0, socow_block_pool::cached_blocks());
+}
+
+TEST(intern, shares_equal_blocks) {
+    socow_intern_table<int, 2> table;
+    socow_vector<int, 2> a, b, c;
+    for (int i = 0; i != 10; ++i) {
+        a.push_back(i);
+        b.push_back(i);
+        c.push_back(i + 1);
+    }
+    EXPECT_FALSE(table.intern(a));
+    EXPECT_EQ(10, a.capacity());
+    EXPECT_TRUE(table.intern(b));
+    EXPECT_EQ(as_const(a).data(), as_const(b).data());
+    EXPECT_TRUE(table.intern(b));
+    EXPECT_FALSE(table.intern(c));
+    EXPECT_EQ(2, table.size());
+
+    socow_vector<int, 2> small;
+    small.push_back(1);
+    EXPECT_FALSE(table.intern(small));
+    EXPECT_EQ(2, table.size());
+}
+
+TEST(intern, write_detaches) {
+    socow_intern_table<std::string, 2> table;
+    socow_vector<std::string, 2> a, b;
+    for (size_t i = 0; i != 10; ++i) {
+        a.push_back(std::to_string(i));
+        b.push_back(std::to_string(i));
+    }
+    table.intern(a);
+    table.intern(b);
+    b[0] = "changed";
+    EXPECT_EQ("0", ::as_const(a)[0]);
+    EXPECT_EQ("changed", ::as_const(b)[0]);
+
+    socow_vector<std::string, 2> c = b;
+    c[0] = "0";
+    EXPECT_TRUE(table.intern(c));
+    EXPECT_EQ(::as_const(a).data(), ::as_const(c).data());
+}
+
+TEST(intern, evict) {
+    socow_intern_table<int, 2> table;
+    socow_vector<int, 2> kept;
+    for (int n = 0; n != 10; ++n) {
+        socow_vector<int, 2> v;
+        for (int i = 0; i != 10; ++i)
+            v.push_back(n * 10 + i);
+        table.intern(v);
+        if (n == 3)
+            kept = v;
+    }
+    EXPECT_EQ(10, table.size());
+    EXPECT_EQ(9, table.evict());
+    EXPECT_EQ(1, table.size());
+
+    for (int n = 0; n != 1000; ++n) {
+        socow_vector<int, 2> v;
+        for (int i = 0; i != 10; ++i)
+            v.push_back(n + i);
+        table.intern(v);
+    }
+    EXPECT_LT(table.size(), 200);
+}
+
+TEST(parallel_copy, detach_and_growth) {
+    socow_parallel::set_threshold(1024);
+    socow_vector<int, 2> a;
+    for (int i = 0; i != 1000000; ++i)
+        a.push_back(i);
+    socow_vector<int, 2> b = a;
+    b[0] = -1;
+    EXPECT_NE(as_const(a).data(), as_const(b).data());
+    EXPECT_EQ(0, as_const(a)[0]);
+    EXPECT_EQ(-1, as_const(b)[0]);
+    EXPECT_TRUE(std::equal(a.begin() + 1, a.end(), as_const(b).begin() + 1));
+    socow_parallel::set_threshold(0);
+}
+
+TEST(parallel_copy, executor_rollback) {
+    size_t runs = 0;
+    socow_parallel::set_executor([&](size_t count, std::function<void(size_t)> const& task) {
+        ++runs;
+        for (size_t i = 0; i != count; ++i)
+            task(count - 1 - i);
+    }, 4);
+    socow_parallel::set_threshold(1);
+    {
+        std::vector<element<size_t>> source;
+        for (size_t i = 0; i != 300000; ++i)
+            source.emplace_back(i);
+        void* memory = operator new(sizeof(element<size_t>) * source.size());
+        element<size_t>* out = static_cast<element<size_t>*>(memory);
+
+        element<size_t>::set_throw_countdown(source.size() / 2 + 10);
+        EXPECT_THROW(socow_parallel::copy(source.data(), source.data() + source.size(), out), std::runtime_error);
+        element<size_t>::set_throw_countdown(0);
+        EXPECT_EQ(source.size(), element<size_t>::instances().size());
+        operator delete(memory);
+
+        socow_vector<element<size_t>, 2> a;
+        for (size_t i = 0; i != 10; ++i)
+            a.push_back(i);
+        socow_vector<element<size_t>, 2> b = a;
+        element<size_t>::set_throw_countdown(5);
+        EXPECT_THROW(b[0] = 1, std::runtime_error);
+        element<size_t>::set_throw_countdown(0);
+        EXPECT_EQ(as_const(a).data(), as_const(b).data());
+    }
+    element<size_t>::expect_no_instances();
+    EXPECT_NE(0, runs);
+    socow_parallel::set_threshold(0);
+    socow_parallel::set_executor(nullptr, 1);
+}
+
+TEST(parallel_copy, serial_for_non_trivial_elements) {
+    size_t runs = 0;
+    socow_parallel::set_executor([&](size_t count, std::function<void(size_t)> const& task) {
+        ++runs;
+        for (size_t i = 0; i != count; ++i)
+            task(i);
+    }, 4);
+    socow_parallel::set_threshold(1);
+    {
+        socow_vector<int, 2> inner;
+        for (int i = 0; i != 10; ++i)
+            inner.push_back(i);
+        socow_vector<socow_vector<int, 2>, 2> a;
+        for (int i = 0; i != 1000; ++i)
+            a.push_back(inner);
+        socow_vector<socow_vector<int, 2>, 2> b = a;
+        runs = 0;
+        socow_vector<int, 2>& row = b[0];
+        EXPECT_EQ(0, runs);
+        row[0] = -1;
+        EXPECT_EQ(0, as_const(inner)[0]);
+        EXPECT_EQ(as_const(inner).data(), as_const(as_const(b)[999]).data());
+    }
+    socow_parallel::set_threshold(0);
+    socow_parallel::set_executor(nullptr, 1);
+}
+
+TEST(streaming_copy, kernel) {
+    std::vector<unsigned char> src(5000), dst(5100);
+    for (size_t i = 0; i != src.size(); ++i)
+        src[i] = static_cast<unsigned char>(i * 7 + 1);
+    for (size_t offset : {0, 1, 7, 16, 33}) {
+        for (size_t n : {0, 1, 15, 64, 100, 4096, 4999}) {
+            std::fill(dst.begin(), dst.end(), 0);
+            socow_simd::stream_bytes(dst.data() + offset, src.data(), n);
+            EXPECT_TRUE(std::equal(src.begin(), src.begin() + n, dst.begin() + offset));
+            EXPECT_EQ(0, dst[offset + n]);
+        }
+    }
+}
+
+TEST(streaming_copy, detach) {
+    socow_simd::set_streaming_fraction(1e-9);
+    EXPECT_LT(socow_simd::streaming_threshold(), 64);
+    socow_vector<uint64_t, 2> a;
+    for (uint64_t i = 0; i != 10000; ++i)
+        a.push_back(i * i);
+    socow_vector<uint64_t, 2> b = a;
+    b[0] = 1;
+    EXPECT_EQ(0, as_const(a)[0]);
+    EXPECT_TRUE(std::equal(a.begin() + 1, a.end(), as_const(b).begin() + 1));
+    socow_simd::set_streaming_fraction(0);
+    EXPECT_EQ(SIZE_MAX, socow_simd::streaming_threshold());
+    socow_simd::set_streaming_fraction(0.5);
+}
+
+namespace {
+using async_vector = socow_vector<size_t, 3>;
+}
+
+TEST(detach_async, installs_prepared_copy) {
+    async_vector a;
+    for (size_t i = 0; i != 100; ++i)
+        a.push_back(i);
+    async_vector b = a;
+    std::shared_future<void> ready = b.prepare_write();
+    ready.wait();
+    b[0] = 42;
+    EXPECT_NE(as_const(a).data(), as_const(b).data());
+    EXPECT_EQ(0, as_const(a)[0]);
+    EXPECT_EQ(42, as_const(b)[0]);
+    EXPECT_EQ(99, as_const(b)[99]);
+}
+
+TEST(detach_async, discards_when_unique) {
+    std::vector<std::function<void()>> queue;
+    auto deferred = [&](std::function<void()> task) { queue.push_back(std::move(task)); };
+    async_vector a;
+    for (size_t i = 0; i != 100; ++i)
+        a.push_back(i);
+    async_vector b = a;
+    std::shared_future<void> ready = b.detach_async(deferred);
+    EXPECT_EQ(1, queue.size());
+    EXPECT_TRUE(b.detach_async(deferred).valid());
+    EXPECT_EQ(1, queue.size());
+    size_t const* p = as_const(b).data();
+    a = async_vector();
+    queue[0]();
+    b.push_back(100);
+    EXPECT_EQ(p, as_const(b).data());
+    EXPECT_EQ(101, b.size());
+
+    async_vector unique;
+    unique.push_back(1);
+    EXPECT_EQ(std::future_status::ready, unique.detach_async(deferred).wait_for(std::chrono::seconds(0)));
+    EXPECT_EQ(1, queue.size());
+}
+
+TEST(detach_async, non_trivial_elements_detach_on_write) {
+    size_t calls = 0;
+    container a;
+    for (size_t i = 0; i != 10; ++i)
+        a.push_back(i);
+    {
+        container b = a;
+        std::shared_future<void> ready = b.detach_async([&](std::function<void()> task) {
+            ++calls;
+            task();
+        });
+        EXPECT_EQ(0, calls);
+        EXPECT_EQ(std::future_status::ready, ready.wait_for(std::chrono::seconds(0)));
+        EXPECT_EQ(std::future_status::ready, b.prepare_write().wait_for(std::chrono::seconds(0)));
+        b[0] = 7;
+        EXPECT_EQ(0, as_const(a)[0]);
+        EXPECT_EQ(7, as_const(b)[0]);
+    }
+    a = container();
+    element<size_t>::expect_no_instances();
+}
+
+namespace {
+using migrating_vector = socow_vector<int, 3>;
+
+struct migration_step {
+    explicit migration_step(size_t step) {
+        migrating_vector::set_migration_step(step);
+        socow_vector<std::shared_ptr<int>, 2>::set_migration_step(step);
+    }
+
+    ~migration_step() {
+        migrating_vector::set_migration_step(0);
+        socow_vector<std::shared_ptr<int>, 2>::set_migration_step(0);
+    }
+};
+} // namespace
+
+TEST(migration, growth) {
+    migration_step step(4);
+    migrating_vector a;
+    for (int i = 0; i != 64; ++i)
+        a.push_back(i);
+    EXPECT_FALSE(a.migrating());
+    size_t capacity = a.capacity();
+    while (a.size() != capacity)
+        a.push_back(static_cast<int>(a.size()));
+    a.push_back(-1);
+    EXPECT_TRUE(a.migrating());
+    EXPECT_EQ(capacity * 2, a.capacity());
+    migrating_vector const& c = a;
+    for (size_t i = 0; i != capacity; ++i)
+        EXPECT_EQ(static_cast<int>(i), c[i]);
+    EXPECT_EQ(-1, c.back());
+    for (int i = 0; i != 3; ++i)
+        a.push_back(-2);
+    EXPECT_TRUE(a.migrating());
+    a.finish_migration();
+    EXPECT_FALSE(a.migrating());
+    EXPECT_EQ(capacity + 4, a.size());
+    EXPECT_EQ(static_cast<int>(capacity - 1), c[capacity - 1]);
+    EXPECT_EQ(-2, c.back());
+}
+
+TEST(migration, detach_on_write) {
+    migration_step step(8);
+    migrating_vector a;
+    for (int i = 0; i != 100; ++i)
+        a.push_back(i);
+    migrating_vector b = a;
+    b[70] = -70;
+    EXPECT_TRUE(b.migrating());
+    migrating_vector const& cb = b;
+    EXPECT_EQ(70, as_const(a)[70]);
+    EXPECT_EQ(-70, cb[70]);
+    EXPECT_EQ(69, cb[69]);
+
+    b.pop_back();
+    b.pop_back();
+    b.push_back(-98);
+    b.front() = -1;
+    EXPECT_TRUE(b.migrating());
+    EXPECT_EQ(99, b.size());
+    EXPECT_EQ(-98, cb.back());
+
+    std::vector<int> expected(a.begin(), a.end());
+    expected.resize(98);
+    expected.push_back(-98);
+    expected[0] = -1;
+    expected[70] = -70;
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(), cb.begin(), cb.end()));
+    EXPECT_TRUE(b.migrating());
+    EXPECT_EQ(99, as_const(a)[99]);
+    b[1] = -2;
+    EXPECT_FALSE(b.migrating());
+    expected[1] = -2;
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(), cb.begin(), cb.end()));
+}
+
+TEST(migration, const_reads_leave_state) {
+    migration_step step(2);
+    auto item = std::make_shared<int>(1);
+    {
+        socow_vector<std::shared_ptr<int>, 2> a;
+        for (int i = 0; i != 50; ++i)
+            a.push_back(item);
+        socow_vector<std::shared_ptr<int>, 2> b = a;
+        b[40] = nullptr;
+        EXPECT_TRUE(b.migrating());
+        auto const& cb = b;
+        std::vector<std::thread> readers;
+        std::atomic<size_t> nulls(0);
+        for (int t = 0; t != 4; ++t) {
+            readers.emplace_back([&] {
+                nulls += std::count(cb.begin(), cb.end(), nullptr);
+            });
+        }
+        for (std::thread& t : readers)
+            t.join();
+        EXPECT_EQ(4, nulls.load());
+        EXPECT_TRUE(b.migrating());
+        socow_vector<std::shared_ptr<int>, 2> c = cb;
+        EXPECT_EQ(cb.data(), ::as_const(c).data());
+        EXPECT_EQ(nullptr, ::as_const(c)[40]);
+        b.push_back(item);
+        b.finish_migration();
+        EXPECT_EQ(51, b.size());
+        EXPECT_EQ(item, cb[50]);
+        EXPECT_EQ(nullptr, cb[40]);
+        c = socow_vector<std::shared_ptr<int>, 2>();
+        b.pop_back();
+        b[41] = nullptr;
+        b.finish_migration();
+        EXPECT_EQ(2, std::count(cb.begin(), cb.end(), nullptr));
+    }
+    EXPECT_EQ(1, item.use_count());
+}
+
+TEST(migration, destroyed_midway) {
+    migration_step step(2);
+    auto item = std::make_shared<int>(1);
+    {
+        socow_vector<std::shared_ptr<int>, 2> a;
+        for (int i = 0; i != 50; ++i)
+            a.push_back(item);
+        {
+            socow_vector<std::shared_ptr<int>, 2> b = a;
+            b[40] = nullptr;
+            b.push_back(item);
+            EXPECT_TRUE(b.migrating());
+            EXPECT_LT(51, item.use_count());
+        }
+        EXPECT_EQ(51, item.use_count());
+        a = socow_vector<std::shared_ptr<int>, 2>();
+    }
+    EXPECT_EQ(1, item.use_count());
+}
+
+TEST(concurrent_builder, seal_adopts_block) {
+    socow_concurrent_builder<int> builder(1000);
+    std::vector<std::thread> producers;
+    for (int t = 0; t != 4; ++t) {
+        producers.emplace_back([&builder, t] {
+            for (int i = 0; i != 250; ++i)
+                builder.push_back(t * 250 + i);
+        });
+    }
+    for (auto& p : producers)
+        p.join();
+    EXPECT_EQ(1000, builder.size());
+    socow_vector<int, 2> v = builder.seal<2>();
+    EXPECT_EQ(1000, v.size());
+    EXPECT_EQ(1000, v.capacity());
+    std::vector<int> sorted(v.begin(), v.end());
+    std::sort(sorted.begin(), sorted.end());
+    for (int i = 0; i != 1000; ++i)
+        EXPECT_EQ(i, sorted[i]);
+    EXPECT_EQ(0, builder.size());
+}
+
+TEST(concurrent_builder, overflows_into_chunks) {
+    socow_concurrent_builder<size_t> builder(100);
+    std::vector<std::thread> producers;
+    for (size_t t = 0; t != 4; ++t) {
+        producers.emplace_back([&builder, t] {
+            size_t batch[10];
+            for (size_t i = 0; i != 100; ++i) {
+                for (size_t j = 0; j != 10; ++j)
+                    batch[j] = t * 1000 + i * 10 + j;
+                builder.append(batch, 10);
+            }
+        });
+    }
+    for (auto& p : producers)
+        p.join();
+    EXPECT_EQ(4000, builder.size());
+    socow_vector<size_t, 2> v = builder.seal<2>();
+    std::vector<size_t> sorted(v.begin(), v.end());
+    std::sort(sorted.begin(), sorted.end());
+    EXPECT_EQ(4000, sorted.size());
+    for (size_t i = 0; i != 4000; ++i)
+        EXPECT_EQ(i, sorted[i]);
+
+    builder.push_back(7);
+    socow_vector<size_t, 2> small = builder.seal<2>();
+    EXPECT_EQ(1, small.size());
+    EXPECT_EQ(7, as_const(small)[0]);
+}
+
+TEST(soa, rows_and_columns) {
+    socow_soa_vector<2, int, double, std::string> v;
+    for (int i = 0; i != 10; ++i)
+        v.push_back(i, i * 0.5, std::to_string(i));
+    EXPECT_EQ(10, v.size());
+    EXPECT_EQ(std::make_tuple(3, 1.5, std::string("3")), v.row(3));
+    auto const& cv = v;
+    auto ints = cv.column<0>();
+    EXPECT_EQ(10, ints.size());
+    EXPECT_EQ(45, std::accumulate(ints.begin(), ints.end(), 0));
+    v.get<2>(9) = "nine";
+    EXPECT_EQ("nine", cv.get<2>(9));
+    v.pop_back();
+    EXPECT_EQ(9, v.size());
+    EXPECT_EQ(9, cv.column<2>().size());
+}
+
+TEST(soa, per_column_detach) {
+    socow_soa_vector<2, int, double> a;
+    for (int i = 0; i != 100; ++i)
+        a.push_back(i, i * 2.0);
+    socow_soa_vector<2, int, double> b = a;
+    EXPECT_TRUE(a == b);
+    for (double& d : b.column<1>())
+        d = -d;
+    EXPECT_EQ(a.column_vector<0>().data(), b.column_vector<0>().data());
+    EXPECT_NE(a.column_vector<1>().data(), b.column_vector<1>().data());
+    EXPECT_EQ(10.0, a.get<1>(5));
+    EXPECT_EQ(-10.0, as_const(b).get<1>(5));
+    EXPECT_TRUE(a != b);
+
+    b.swap(a);
+    EXPECT_EQ(-10.0, as_const(a).get<1>(5));
+}
+
+TEST(soa, push_back_is_atomic) {
+    socow_soa_vector<2, int, element<size_t>> v;
+    v.push_back(1, element<size_t>(1));
+    element<size_t>::set_throw_countdown(1);
+    EXPECT_THROW(v.push_back(2, element<size_t>(2)), std::runtime_error);
+    element<size_t>::set_throw_countdown(0);
+    EXPECT_EQ(1, v.size());
+    EXPECT_EQ(1, v.column_vector<0>().size());
+    v.clear();
+    EXPECT_TRUE(v.empty());
+    element<size_t>::expect_no_instances();
+}
+
+TEST(bit_vector, packs_and_shares) {
+    socow_vector<bool, 64> a;
+    EXPECT_LT(sizeof(a), sizeof(socow_vector<char, 64>));
+    for (size_t i = 0; i != 200; ++i)
+        a.push_back(i % 3 == 0);
+    EXPECT_EQ(200, a.size());
+    EXPECT_EQ(67, a.count());
+    EXPECT_TRUE(as_const(a)[3]);
+    EXPECT_FALSE(as_const(a)[4]);
+
+    socow_vector<bool, 64> b = a;
+    b[4] = true;
+    b[3].flip();
+    EXPECT_FALSE(as_const(a)[4]);
+    EXPECT_TRUE(as_const(b)[4]);
+    EXPECT_FALSE(as_const(b)[3]);
+    EXPECT_TRUE(a != b);
+
+    for (size_t i = 0; i != 100; ++i)
+        b.pop_back();
+    EXPECT_EQ(100, b.size());
+    b.push_back(false);
+    EXPECT_FALSE(as_const(b).back());
+    b.flip();
+    EXPECT_EQ(67, b.count());
+}
+
+TEST(bit_vector, find) {
+    socow_vector<bool, 64> v;
+    EXPECT_EQ(v.npos, v.find_first());
+    for (size_t i = 0; i != 300; ++i)
+        v.push_back(i == 5 || i == 63 || i == 64 || i == 250);
+    std::vector<size_t> found;
+    for (size_t i = v.find_first(); i != v.npos; i = v.find_next(i))
+        found.push_back(i);
+    EXPECT_EQ((std::vector<size_t>{5, 63, 64, 250}), found);
+    EXPECT_EQ(v.npos, v.find_next(299));
+}
+
+TEST(bit_vector, bitwise) {
+    socow_vector<bool, 8> a, b;
+    for (size_t i = 0; i != 130; ++i) {
+        a.push_back(i % 2 == 0);
+        b.push_back(i % 3 == 0);
+    }
+    socow_vector<bool, 8> a_copy = a;
+    socow_vector<bool, 8> both = a & b;
+    socow_vector<bool, 8> either = a | b;
+    socow_vector<bool, 8> one = a ^ b;
+    EXPECT_TRUE(a == a_copy);
+    for (size_t i = 0; i != 130; ++i) {
+        EXPECT_EQ(i % 6 == 0, as_const(both)[i]);
+        EXPECT_EQ(i % 2 == 0 || i % 3 == 0, as_const(either)[i]);
+        EXPECT_EQ((i % 2 == 0) != (i % 3 == 0), as_const(one)[i]);
+    }
+    a ^= a;
+    EXPECT_EQ(0, a.count());
+    EXPECT_EQ(65, a_copy.count());
+    b.push_back(true);
+    EXPECT_THROW(a |= b, std::invalid_argument);
+}
+
+TEST(bit_vector, iterators_insert_erase_resize) {
+    using bits = socow_vector<bool, 8>;
+    bits v;
+    std::vector<bool> expected;
+    for (size_t i = 0; i != 150; ++i) {
+        v.push_back(i % 5 == 0);
+        expected.push_back(i % 5 == 0);
+    }
+    bits const copy = v;
+    EXPECT_EQ(30, std::count(copy.begin(), copy.end(), true));
+    EXPECT_EQ(150, copy.end() - copy.begin());
+    EXPECT_EQ(5, std::find(copy.begin() + 1, copy.end(), true) - copy.begin());
+
+    for (bits::reference b : v)
+        b = !b;
+    for (size_t i = 0; i != expected.size(); ++i)
+        expected[i] = !expected[i];
+    v.insert(v.begin() + 3, true);
+    expected.insert(expected.begin() + 3, true);
+    v.insert(v.begin() + 64, false);
+    expected.insert(expected.begin() + 64, false);
+    v.insert(v.end(), true);
+    expected.insert(expected.end(), true);
+    v.erase(v.begin() + 10, v.begin() + 80);
+    expected.erase(expected.begin() + 10, expected.begin() + 80);
+    v.erase(v.begin() + 1);
+    expected.erase(expected.begin() + 1);
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(), as_const(v).begin(), as_const(v).end()));
+    EXPECT_EQ(std::count(expected.begin(), expected.end(), true), v.count());
+
+    v.resize(200, true);
+    expected.resize(200, true);
+    v.resize(130);
+    expected.resize(130);
+    v.resize(140);
+    expected.resize(140);
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(), as_const(v).begin(), as_const(v).end()));
+    EXPECT_EQ(std::count(expected.begin(), expected.end(), true), v.count());
+    EXPECT_EQ(30, std::count(copy.begin(), copy.end(), true));
+}
+
+TEST(bit_vector, ordering) {
+    using bits = socow_vector<bool, 8>;
+    bits a, b;
+    for (size_t i = 0; i != 100; ++i) {
+        a.push_back(i == 70);
+        b.push_back(i == 70);
+    }
+    EXPECT_FALSE(a < b);
+    EXPECT_TRUE(a <= b);
+    b[90] = true;
+    EXPECT_TRUE(a < b);
+    a[65] = true;
+    EXPECT_TRUE(b < a);
+    EXPECT_TRUE(a >= b);
+    bits prefix = b;
+    prefix.resize(80);
+    EXPECT_TRUE(prefix < b);
+    EXPECT_TRUE(b > prefix);
+    EXPECT_EQ(std::vector<bool>(prefix.begin(), prefix.end()) < std::vector<bool>(a.begin(), a.end()), prefix < a);
+}
+
+TEST(string, small_and_shared) {
+    using string = socow_string<char, 7>;
+    string s("tag");
+    EXPECT_EQ(3, s.size());
+    EXPECT_STREQ("tag", s.c_str());
+    s += ":value";
+    EXPECT_STREQ("tag:value", s.c_str());
+    string t = s;
+    EXPECT_EQ(s.c_str(), t.c_str());
+    EXPECT_TRUE(s == t);
+    EXPECT_EQ(std::hash<string>()(s), std::hash<string>()(t));
+
+    t[0] = 'T';
+    EXPECT_STREQ("tag:value", s.c_str());
+    EXPECT_STREQ("Tag:value", t.c_str());
+    EXPECT_TRUE(t < s);
+    t.append(t.data(), 3);
+    EXPECT_STREQ("Tag:valueTag", t.c_str());
+    while (!t.empty())
+        t.pop_back();
+    EXPECT_STREQ("", t.c_str());
+    EXPECT_EQ(0, string().size());
+}
+
+TEST(string, search) {
+    std::string text;
+    for (int i = 0; i != 50; ++i)
+        text += "abcab";
+    text += "needle";
+    using string = socow_string<char, 15>;
+    string s(text.c_str());
+    EXPECT_EQ(250, s.find("needle"));
+    EXPECT_EQ(text.find("bca", 7), s.find("bca", 7));
+    EXPECT_EQ(s.npos, s.find("needles"));
+    EXPECT_EQ(text.find('n'), s.find('n'));
+    EXPECT_EQ(s.npos, s.find('z'));
+    EXPECT_EQ(0, s.find(""));
+    EXPECT_TRUE(s.starts_with("abcaba"));
+    EXPECT_FALSE(s.starts_with("abd"));
+    EXPECT_TRUE(s.ends_with("needle"));
+    EXPECT_EQ(0, s.compare(text));
+    EXPECT_LT(s.compare(text + "x"), 0);
+    EXPECT_GT(s.compare("abcaa"), 0);
+    EXPECT_LT(string("a\x7f").compare("a\x80"), 0);
+}
+
+TEST(flat_set, insert_find_erase) {
+    socow_flat_set<int, 4> s;
+    for (int i : {5, 1, 9, 3, 7, 1, 5})
+        s.insert(i);
+    EXPECT_EQ((std::vector<int>{1, 3, 5, 7, 9}), std::vector<int>(s.begin(), s.end()));
+    for (int i = 0; i != 11; ++i)
+        EXPECT_EQ(i % 2 == 1, s.contains(i));
+    socow_flat_set<int, 4> snapshot = s;
+    EXPECT_EQ(snapshot.keys().data(), s.keys().data());
+    EXPECT_TRUE(s.erase(5));
+    EXPECT_FALSE(s.erase(5));
+    EXPECT_TRUE(snapshot.contains(5));
+    EXPECT_FALSE(s.contains(5));
+
+    std::vector<int> more = {8, 2, 3, 100, -1, 8};
+    s.insert(more.begin(), more.end());
+    EXPECT_EQ((std::vector<int>{-1, 1, 2, 3, 7, 8, 9, 100}), std::vector<int>(s.begin(), s.end()));
+}
+
+TEST(flat_map, snapshot_and_bulk_insert) {
+    socow_flat_map<std::string, int, 2> m;
+    EXPECT_TRUE(m.insert("b", 2));
+    EXPECT_TRUE(m.insert("a", 1));
+    EXPECT_FALSE(m.insert("a", 10));
+    EXPECT_EQ(1, m.at("a"));
+    EXPECT_THROW(::as_const(m).at("z"), std::out_of_range);
+    for (int i = 0; i != 20; ++i)
+        m.insert_or_assign("k" + std::to_string(i), i);
+    EXPECT_EQ(22, m.size());
+
+    socow_flat_map<std::string, int, 2> snapshot = m;
+    *m.find("k3") = 33;
+    EXPECT_EQ(snapshot.keys().data(), m.keys().data());
+    EXPECT_NE(snapshot.values().data(), m.values().data());
+    EXPECT_EQ(3, *::as_const(snapshot).find("k3"));
+    EXPECT_EQ(33, *::as_const(m).find("k3"));
+
+    std::vector<std::pair<std::string, int>> more = {{"c", 3}, {"a", 100}, {"c", 4}, {"0", 0}};
+    m.insert(more.begin(), more.end());
+    EXPECT_EQ(24, m.size());
+    EXPECT_EQ(1, m.at("a"));
+    EXPECT_EQ(3, m.at("c"));
+    EXPECT_EQ("0", m.keys()[0]);
+    EXPECT_TRUE(std::is_sorted(m.keys().begin(), m.keys().end()));
+    EXPECT_TRUE(m.erase("c"));
+    EXPECT_FALSE(m.contains("c"));
+    EXPECT_EQ(23, m.values().size());
+}
+
+namespace {
+struct fragile_key {
+    fragile_key(int v) : v(v) {}
+
+    fragile_key(fragile_key const& that) : v(that.v) {
+        if (fail) {
+            throw std::runtime_error("fragile_key copy");
+        }
+    }
+
+    fragile_key& operator=(fragile_key const&) = default;
+
+    friend bool operator<(fragile_key const& a, fragile_key const& b) {
+        return a.v < b.v;
+    }
+
+    int v;
+    static inline bool fail = false;
+};
+} // namespace
+
+TEST(flat_map, failed_erase_and_empty_insert) {
+    socow_flat_map<fragile_key, int, 2> m;
+    for (int i = 0; i != 10; ++i)
+        m.insert(fragile_key(i), i * 10);
+    socow_flat_map<fragile_key, int, 2> snapshot = m;
+    fragile_key::fail = true;
+    EXPECT_THROW(m.erase(4), std::runtime_error);
+    fragile_key::fail = false;
+    EXPECT_EQ(10, m.size());
+    EXPECT_EQ(10, m.values().size());
+    EXPECT_EQ(40, ::as_const(m).at(4));
+    EXPECT_EQ(50, ::as_const(m).at(5));
+
+    std::vector<std::pair<fragile_key, int>> none;
+    m.insert(none.begin(), none.end());
+    EXPECT_EQ(snapshot.keys().data(), m.keys().data());
+    EXPECT_EQ(snapshot.values().data(), m.values().data());
+    EXPECT_TRUE(m.erase(4));
+    EXPECT_EQ(9, m.size());
+    EXPECT_EQ(50, ::as_const(m).at(5));
+    EXPECT_EQ(10, snapshot.size());
+}
+
+TEST(front_slack, push_and_pop_front) {
+    container a;
+    for (size_t i = 0; i != 100; ++i)
+        a.push_front(i);
+    EXPECT_EQ(100, a.size());
+    for (size_t i = 0; i != 100; ++i)
+        EXPECT_EQ(99 - i, as_const(a)[i]);
+
+    container b = a;
+    element<size_t> const* shared = as_const(b).data();
+    a.emplace_front(1000);
+    EXPECT_EQ(shared, as_const(b).data());
+    EXPECT_EQ(1000, as_const(a).front());
+    EXPECT_EQ(99, as_const(b).front());
+
+    element<size_t> const* before = as_const(a).data();
+    a.push_front(1001);
+    EXPECT_EQ(before - 1, as_const(a).data());
+    a.pop_front();
+    a.pop_front();
+    EXPECT_TRUE(a == b);
+    b.pop_front();
+    EXPECT_EQ(98, as_const(b).front());
+    while (!b.empty())
+        b.pop_front();
+}
+
+TEST(front_slack, insert_and_erase_near_front) {
+    socow_vector<size_t, 2> v;
+    std::vector<size_t> expected;
+    for (size_t i = 0; i != 200; ++i) {
+        v.insert(as_const(v).begin() + i / 10, i);
+        expected.insert(expected.begin() + i / 10, i);
+    }
+    EXPECT_EQ(expected, std::vector<size_t>(as_const(v).begin(), as_const(v).end()));
+    v.erase(as_const(v).begin() + 3, as_const(v).begin() + 7);
+    expected.erase(expected.begin() + 3, expected.begin() + 7);
+    v.erase(as_const(v).end() - 5);
+    expected.erase(expected.end() - 5);
+    EXPECT_EQ(expected, std::vector<size_t>(as_const(v).begin(), as_const(v).end()));
+    v.shrink_to_fit();
+    EXPECT_EQ(v.size(), v.capacity());
+    EXPECT_EQ(expected, std::vector<size_t>(as_const(v).begin(), as_const(v).end()));
+}
+
+TEST(front_slack, emplace_front_failure) {
+    container a;
+    for (size_t i = 0; i != 10; ++i)
+        a.push_back(i);
+    container b = a;
+    element<size_t>::set_throw_countdown(5);
+    EXPECT_THROW(a.push_front(42), std::runtime_error);
+    element<size_t>::set_throw_countdown(0);
+    EXPECT_TRUE(a == b);
+    EXPECT_EQ(as_const(a).data(), as_const(b).data());
+}
+
+TEST(compress, shared_and_unpacked_on_demand) {
+    socow_vector<uint32_t, 4> a;
+    for (uint32_t i = 0; i != 1000; ++i)
+        a.push_back(1000000 + i * 3);
+    socow_vector<uint32_t, 4> const original = a;
+    a.compress();
+    EXPECT_TRUE(a.compressed());
+    EXPECT_EQ(1000, a.size());
+
+    socow_vector<uint32_t, 4> b = a;
+    EXPECT_TRUE(b.compressed());
+    EXPECT_TRUE(a.contains(1000000 + 999 * 3));
+    EXPECT_FALSE(a.contains(1000001));
+    EXPECT_FALSE(a.contains(7));
+    EXPECT_EQ(1, a.count(1000300));
+    uint64_t sum = 0;
+    a.for_each([&](uint32_t x) { sum += x; });
+    EXPECT_EQ(std::accumulate(original.begin(), original.end(), uint64_t(0)), sum);
+    EXPECT_TRUE(a.compressed());
+
+    EXPECT_EQ(1000003, as_const(b)[1]);
+    EXPECT_TRUE(b.compressed());
+    EXPECT_TRUE(a.compressed());
+    EXPECT_TRUE(b == original);
+    b.push_back(5);
+    EXPECT_FALSE(b.compressed());
+    EXPECT_TRUE(a.compressed());
+    a.push_back(5);
+    EXPECT_FALSE(a.compressed());
+    EXPECT_EQ(1001, a.size());
+    EXPECT_EQ(1000000, as_const(a)[0]);
+    EXPECT_EQ(5, as_const(a).back());
+}
+
+TEST(compress, const_reads_share_decoded_copy) {
+    using packed = socow_vector<uint16_t, 4>;
+    packed a;
+    for (size_t i = 0; i != 1000; ++i)
+        a.push_back(static_cast<uint16_t>(i / 3));
+    std::vector<uint16_t> expected(as_const(a).begin(), as_const(a).end());
+    size_t hash = std::hash<packed>()(a);
+    a.compress();
+    packed const b = a;
+
+    std::vector<uint16_t const*> seen(4);
+    std::vector<std::thread> readers;
+    for (size_t t = 0; t != seen.size(); ++t) {
+        readers.emplace_back([&b, &seen, t]() {
+            seen[t] = b.data();
+        });
+    }
+    for (std::thread& t : readers)
+        t.join();
+    for (uint16_t const* p : seen)
+        EXPECT_EQ(seen[0], p);
+    EXPECT_EQ(seen[0], as_const(a).data());
+    EXPECT_TRUE(a.compressed());
+    EXPECT_TRUE(b.compressed());
+    EXPECT_EQ(expected, std::vector<uint16_t>(b.begin(), b.end()));
+    EXPECT_EQ(expected.back(), b.back());
+
+    EXPECT_EQ(b.begin() + 600, b.find(200));
+    EXPECT_EQ(b.begin() + 999, b.find(333));
+    EXPECT_EQ(b.end(), b.find(334));
+    EXPECT_TRUE(b.compressed());
+    EXPECT_EQ(hash, std::hash<packed>()(b));
+}
+
+TEST(compress, wide_and_incompressible_values) {
+    socow_vector<uint64_t, 2> wide;
+    std::vector<uint64_t> expected;
+    for (uint64_t i = 0; i != 300; ++i)
+        expected.push_back(i == 5 ? ~uint64_t(0) - i : i * 0x10001);
+    for (uint64_t x : expected)
+        wide.push_back(x);
+    wide.compress();
+    EXPECT_TRUE(wide.compressed());
+    EXPECT_TRUE(wide.contains(~uint64_t(0) - 5));
+    EXPECT_EQ(expected, std::vector<uint64_t>(as_const(wide).begin(), as_const(wide).end()));
+
+    socow_vector<uint64_t, 2> random;
+    uint64_t x = 88172645463325252ull;
+    for (size_t i = 0; i != 256; ++i) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        random.push_back(x);
+    }
+    random.compress();
+    EXPECT_FALSE(random.compressed());
+
+    socow_vector<uint32_t, 2> constant;
+    for (size_t i = 0; i != 500; ++i)
+        constant.push_back(42);
+    constant.compress();
+    EXPECT_TRUE(constant.compressed());
+    EXPECT_EQ(500, constant.count(42));
+    constant.clear();
+    EXPECT_TRUE(constant.empty());
+    EXPECT_FALSE(constant.compressed());
+}
+
+#if SOCOW_HAS_CONSTEXPR
+constexpr socow_vector<int, 8> squares(int n) {
+    socow_vector<int, 8> result;
+    for (int i = 0; i != n; ++i)
+        result.push_back(i * i);
+    return result;
+}
+
+constexpr int sum_of_copy(socow_vector<int, 8> const& v) {
+    socow_vector<int, 8> copy = v;
+    socow_vector<int, 8> other;
+    other = copy;
+    int sum = 0;
+    for (int x : other)
+        sum += x;
+    return sum;
+}
+
+TEST(constexpr_table, built_at_compile_time) {
+    constexpr socow_vector<int, 8> table = squares(6);
+    static_assert(table.size() == 6);
+    static_assert(table[5] == 25);
+    static_assert(table.back() == 25);
+    static_assert(sum_of_copy(table) == 55);
+    static_assert(sum_of_copy(squares(8)) == 140);
+    EXPECT_EQ(16, table[4]);
+    EXPECT_EQ(55, std::accumulate(table.begin(), table.end(), 0));
+}
+#endif
+
+namespace {
+struct no_default {
+    explicit no_default(int v) : v(v) {}
+    int const v;
+};
+} // namespace
+
+TEST(constexpr_table, runtime_only_element_types) {
+    socow_vector<no_default, 2> a;
+    for (int i = 0; i != 5; ++i)
+        a.push_back(no_default(i));
+    socow_vector<no_default, 2> small;
+    small.push_back(no_default(7));
+    socow_vector<no_default, 2> b = a;
+    socow_vector<no_default, 2> c = small;
+    EXPECT_EQ(4, b.back().v);
+    EXPECT_EQ(7, c.front().v);
+}
+
+TEST(eager_copy, small_heap_blocks_copied_up_front) {
+    using vector = socow_vector<int16_t, 3>;
+    vector a;
+    for (int16_t i = 0; i != 8; ++i)
+        a.push_back(i);
+    vector big;
+    for (int16_t i = 0; i != 100; ++i)
+        big.push_back(i);
+
+    vector::set_eager_copy(8 * sizeof(int16_t));
+    vector b = a;
+    EXPECT_NE(as_const(a).data(), as_const(b).data());
+    EXPECT_TRUE(a == b);
+    vector c = big;
+    EXPECT_EQ(as_const(big).data(), as_const(c).data());
+    vector d;
+    d = a;
+    EXPECT_NE(as_const(a).data(), as_const(d).data());
+    EXPECT_TRUE(a == d);
+
+    vector::set_eager_copy(8 * sizeof(int16_t), true);
+    vector e = a;
+    EXPECT_EQ(as_const(a).data(), as_const(e).data());
+    e[0] = 42;
+    size_t eager = 0;
+    for (size_t i = 0; i != 32; ++i) {
+        vector f = a;
+        eager += as_const(a).data() != as_const(f).data();
+        f[1] = 7;
+    }
+    EXPECT_EQ(30, eager);
+    EXPECT_EQ(0, as_const(a)[0]);
+    EXPECT_EQ(1, as_const(a)[1]);
+
+    vector::set_eager_copy(0);
+    vector g = a;
+    EXPECT_EQ(as_const(a).data(), as_const(g).data());
+}
+
+TEST(eager_copy, every_detach_path_counts) {
+    using vector = socow_vector<int16_t, 3>;
+    vector a;
+    for (int16_t i = 0; i != 8; ++i)
+        a.push_back(i);
+    vector::set_migration_step(2);
+    vector::set_eager_copy(8 * sizeof(int16_t), true);
+    size_t eager = 0;
+    for (size_t i = 0; i != 32; ++i) {
+        vector f = a;
+        eager += as_const(a).data() != as_const(f).data();
+        f[1] = 7;
+    }
+    EXPECT_EQ(29, eager);
+    vector::set_migration_step(0);
+
+    vector::set_eager_copy(8 * sizeof(int16_t), true);
+    eager = 0;
+    for (size_t i = 0; i != 32; ++i) {
+        vector f = a;
+        eager += as_const(a).data() != as_const(f).data();
+        f.push_front(7);
+    }
+    EXPECT_EQ(29, eager);
+
+    vector::set_eager_copy(8 * sizeof(int16_t), true);
+    eager = 0;
+    for (size_t i = 0; i != 32; ++i) {
+        vector f = a;
+        eager += as_const(a).data() != as_const(f).data();
+        f.detach_async([](std::function<void()> task) { task(); });
+        f[1] = 7;
+    }
+    EXPECT_EQ(29, eager);
+    vector::set_eager_copy(0);
+    EXPECT_EQ(1, as_const(a)[1]);
+}
+
+TEST(resize, grow_shrink_and_fill) {
+    socow_vector<int, 3> a;
+    a.resize(2);
+    EXPECT_EQ(2, a.size());
+    EXPECT_EQ(0, as_const(a)[1]);
+    a.resize(5, 7);
+    EXPECT_EQ(5, a.size());
+    EXPECT_EQ(0, as_const(a)[0]);
+    EXPECT_EQ(7, as_const(a)[4]);
+    socow_vector<int, 3> b = a;
+    b.resize(100);
+    EXPECT_EQ(7, as_const(a)[4]);
+    EXPECT_EQ(5, a.size());
+    EXPECT_EQ(7, as_const(b)[4]);
+    EXPECT_EQ(0, as_const(b)[99]);
+    b.resize(2);
+    EXPECT_EQ(2, b.size());
+    b.resize(6, as_const(b)[0]);
+    EXPECT_EQ(0, as_const(b)[5]);
+    a.resize_default_init(8);
+    EXPECT_EQ(8, a.size());
+    EXPECT_EQ(7, as_const(a)[4]);
+
+    socow_vector<std::string, 2> s;
+    s.resize(4, "xy");
+    s.resize(6);
+    EXPECT_EQ("xy", ::as_const(s)[3]);
+    EXPECT_EQ("", ::as_const(s)[5]);
+    socow_vector<std::string, 2> t = s;
+    t.resize(1);
+    EXPECT_EQ(6, s.size());
+    EXPECT_EQ(1, t.size());
+    EXPECT_EQ("xy", ::as_const(t)[0]);
+}
+
+TEST(resize, large_zero_filled_blocks) {
+    size_t const n = size_t(1) << 22;
+    socow_vector<uint32_t, 4> hist;
+    hist.push_back(9);
+    hist.resize(n);
+    EXPECT_EQ(n, hist.size());
+    EXPECT_EQ(9, as_const(hist)[0]);
+    EXPECT_EQ(0, as_const(hist)[n / 2]);
+    EXPECT_EQ(0, as_const(hist)[n - 1]);
+    hist[n - 1] = 3;
+    socow_vector<uint32_t, 4> copy = hist;
+    copy.push_back(4);
+    EXPECT_EQ(3, as_const(copy)[n - 1]);
+    EXPECT_EQ(4, as_const(copy)[n]);
+    EXPECT_EQ(n, hist.size());
+
+    socow_vector<double, 4> small_block;
+    small_block.resize(100);
+    EXPECT_EQ(0.0, std::accumulate(as_const(small_block).begin(), as_const(small_block).end(), 0.0));
+    small_block.shrink_to_fit();
+    EXPECT_EQ(100, small_block.size());
+}
+
+TEST(jagged, rows_share_one_block) {
+    socow_jagged<int, 4> a;
+    a.push_row({1, 2, 3});
+    a.push_row();
+    a.push_row({4});
+    a.push_back(5);
+    EXPECT_EQ(3, a.size());
+    EXPECT_EQ(5, a.total_size());
+    EXPECT_EQ(3, ::as_const(a)[0].size());
+    EXPECT_TRUE(::as_const(a)[1].empty());
+    EXPECT_EQ(5, ::as_const(a).back()[1]);
+
+    for (int i = 0; i != 10; ++i) {
+        std::vector<int> row(i, i);
+        a.push_row(row.begin(), row.end());
+    }
+    socow_jagged<int, 4> b = a;
+    EXPECT_EQ(a.values().data(), b.values().data());
+    EXPECT_EQ(a.offsets().data(), b.offsets().data());
+    b[12][3] = 100;
+    EXPECT_NE(a.values().data(), b.values().data());
+    EXPECT_EQ(a.offsets().data(), b.offsets().data());
+    EXPECT_EQ(9, ::as_const(a)[12][3]);
+    EXPECT_EQ(100, ::as_const(b)[12][3]);
+    EXPECT_TRUE(a != b);
+
+    b.pop_row();
+    b.pop_row();
+    EXPECT_EQ(11, b.size());
+    EXPECT_EQ(5 + 28, b.total_size());
+    EXPECT_EQ(13, a.size());
+    b.clear();
+    EXPECT_TRUE(b.empty());
+    b.swap(a);
+    EXPECT_EQ(13, b.size());
+    EXPECT_TRUE(a.empty());
+}
+
+TEST(jagged, nested_round_trip) {
+    using jagged = socow_jagged<size_t, 4>;
+    socow_vector<socow_vector<size_t, 2>, 2> nested;
+    for (size_t i = 0; i != 50; ++i) {
+        nested.push_back(socow_vector<size_t, 2>());
+        for (size_t j = 0; j != i % 7; ++j)
+            nested.back().push_back(i * 10 + j);
+    }
+    jagged flat(nested);
+    EXPECT_EQ(50, flat.size());
+    for (size_t i = 0; i != 50; ++i) {
+        auto row = ::as_const(flat)[i];
+        ASSERT_EQ(i % 7, row.size());
+        EXPECT_TRUE(std::equal(row.begin(), row.end(), ::as_const(nested)[i].begin()));
+    }
+    auto back = flat.to_nested<3, 4>();
+    ASSERT_EQ(50, back.size());
+    for (size_t i = 0; i != 50; ++i)
+        EXPECT_TRUE(std::equal(::as_const(back)[i].begin(), ::as_const(back)[i].end(), ::as_const(nested)[i].begin(), ::as_const(nested)[i].end()));
+    EXPECT_TRUE(jagged(back) == flat);
+    size_t rows = 0;
+    for (auto row : ::as_const(flat)) {
+        EXPECT_EQ(rows % 7, row.size());
+        ++rows;
+    }
+    EXPECT_EQ(50, rows);
+    using traits = std::iterator_traits<jagged::const_iterator>;
+    static_assert(std::is_same<traits::value_type, jagged::span<size_t const>>::value);
+    EXPECT_EQ(50, std::distance(flat.begin(), flat.end()));
+}
+
+TEST(jagged, failed_detach_keeps_rows) {
+    {
+        socow_jagged<element<size_t>, 2> a;
+        for (size_t i = 0; i != 4; ++i) {
+            std::vector<element<size_t>> row(i + 1, element<size_t>(i));
+            a.push_row(row.begin(), row.end());
+        }
+        socow_jagged<element<size_t>, 2> b = a;
+        element<size_t>::set_throw_countdown(3);
+        EXPECT_THROW(b.pop_row(), std::runtime_error);
+        element<size_t>::set_throw_countdown(0);
+        EXPECT_EQ(4, b.size());
+        EXPECT_EQ(10, b.total_size());
+        EXPECT_TRUE(a == b);
+        b.pop_row();
+        EXPECT_EQ(3, b.size());
+        EXPECT_EQ(6, b.total_size());
+    }
+    element<size_t>::expect_no_instances();
+}